@@ -0,0 +1,205 @@
+#include "SyntheticEvents.hpp"
+
+#include "TClonesArray.h"
+#include "TProcessID.h"
+#include "classes/DelphesClasses.h"
+
+#include <cmath>
+#include <random>
+
+
+namespace {
+    struct Axis {
+        double eta;
+        double phi;
+    };
+
+    double wrap_phi(double phi) {
+        return std::remainder(phi, 2 * M_PI);
+    }
+
+    void set_track(Track* track, double pt, double eta, double phi, int charge) {
+        track->PT = pt;
+        track->Eta = eta;
+        track->Phi = wrap_phi(phi);
+        track->Mass = 0.13957;
+        track->Charge = charge;
+        track->P = pt * std::cosh(eta);
+        track->PID = 211 * charge;
+    }
+
+    void set_tower(Tower* tower, double et, double eta, double phi, double em_fraction) {
+        tower->ET = et;
+        tower->Eta = eta;
+        tower->Phi = wrap_phi(phi);
+        tower->E = et * std::cosh(eta);
+        tower->Eem = em_fraction * tower->E;
+        tower->Ehad = tower->E - tower->Eem;
+    }
+
+    void set_particle(GenParticle* particle, int pid, int status, int m1, int d1, int d2,
+                      double pt, double eta, double phi, double mass) {
+        particle->PID = pid;
+        particle->Status = status;
+        particle->M1 = m1;
+        particle->M2 = -1;
+        particle->D1 = d1;
+        particle->D2 = d2;
+        particle->Charge = (pid == 22 || pid == 111) ? 0 : (pid > 0 ? 1 : -1);
+        particle->PT = pt;
+        particle->Eta = eta;
+        particle->Phi = wrap_phi(phi);
+        particle->Mass = mass;
+        particle->Px = pt * std::cos(phi);
+        particle->Py = pt * std::sin(phi);
+        particle->Pz = pt * std::sinh(eta);
+        particle->E = std::sqrt(particle->Px * particle->Px + particle->Py * particle->Py +
+                                particle->Pz * particle->Pz + mass * mass);
+    }
+}
+
+
+TTree* GenerateSyntheticEvents(const SyntheticConfig& config, TDirectory* dir) {
+    TDirectory::TContext context(dir);
+
+    TClonesArray* jets = new TClonesArray("Jet");
+    TClonesArray* genJets = new TClonesArray("Jet");
+    TClonesArray* tracks = new TClonesArray("Track");
+    TClonesArray* photons = new TClonesArray("Tower");
+    TClonesArray* hadrons = new TClonesArray("Tower");
+    TClonesArray* particles = new TClonesArray("GenParticle");
+
+    TTree* tree = new TTree("Delphes", "Synthetic Delphes-like events");
+    tree->Branch("Jet", &jets, 64000, 99);
+    tree->Branch("GenJet", &genJets, 64000, 99);
+    tree->Branch("EFlowTrack", &tracks, 64000, 99);
+    tree->Branch("EFlowPhoton", &photons, 64000, 99);
+    tree->Branch("EFlowNeutralHadron", &hadrons, 64000, 99);
+    tree->Branch("Particle", &particles, 64000, 99);
+
+    std::mt19937_64 rng(config.seed);
+    std::uniform_real_distribution<double> uniform(0., 1.);
+    std::uniform_real_distribution<double> flat_eta(-2.5, 2.5);
+    std::uniform_real_distribution<double> flat_phi(-M_PI, M_PI);
+    std::normal_distribution<double> spread(0., 0.12);
+    std::normal_distribution<double> smear(0., 0.05);
+    std::exponential_distribution<double> jet_pt(1. / 30.);
+    std::exponential_distribution<double> soft_pt(1. / 1.5);
+    std::poisson_distribution<int> n_jets(config.jets);
+    std::poisson_distribution<int> n_constituents(config.constituents);
+    std::poisson_distribution<int> n_tracks(config.tracks);
+    std::poisson_distribution<int> n_towers(config.towers);
+    std::poisson_distribution<int> n_particles(config.particles);
+
+    const int flavors[] = {21, 21, 1, 2, 3, 4, 5};
+
+    for (long long event = 0; event < config.events; ++event) {
+        // Keep the TRef ids small, as for every event of a Delphes file
+        UInt_t object_count = TProcessID::GetObjectCount();
+
+        jets->Clear("C");
+        genJets->Clear("C");
+        tracks->Clear("C");
+        photons->Clear("C");
+        hadrons->Clear("C");
+        particles->Clear("C");
+
+        int jet_count = std::max(1, n_jets(rng));
+        std::vector<Axis> axes;
+        int track_index = 0, photon_index = 0, hadron_index = 0;
+
+        for (int j = 0; j < jet_count; ++j) {
+            Axis axis = {flat_eta(rng), flat_phi(rng)};
+            axes.push_back(axis);
+
+            Jet* jet = (Jet*) jets->ConstructedAt(j);
+            jet->Constituents.Clear();
+            jet->PT = 20. + jet_pt(rng);
+            jet->Eta = axis.eta;
+            jet->Phi = axis.phi;
+            jet->Mass = 2. + 10. * uniform(rng);
+            jet->DeltaEta = 0.05 + 0.1 * uniform(rng);
+            jet->DeltaPhi = 0.05 + 0.1 * uniform(rng);
+            jet->Flavor = flavors[(int) (uniform(rng) * 7)];
+            jet->BTag = uniform(rng) < 0.1;
+            jet->Charge = (int) (3 * uniform(rng)) - 1;
+            jet->EhadOverEem = 2. * uniform(rng);
+            for (int t = 0; t < 5; ++t)
+                jet->Tau[t] = uniform(rng) / (t + 1);
+
+            jet->NSubJetsTrimmed = uniform(rng) < 0.7 ? 2 : 0;
+            for (int t = 0; t < 5; ++t)
+                jet->TrimmedP4[t].SetPtEtaPhiM(0, 0, 0, 0);
+            if (jet->NSubJetsTrimmed > 0)
+                jet->TrimmedP4[1].SetPtEtaPhiM(0.8 * jet->PT, axis.eta + smear(rng), wrap_phi(axis.phi + smear(rng)), 1.);
+
+            int constituents = std::max(2, n_constituents(rng));
+            int charged = 0, neutrals = 0;
+            for (int c = 0; c < constituents; ++c) {
+                double eta = axis.eta + spread(rng);
+                double phi = axis.phi + spread(rng);
+                double pt = 0.2 + soft_pt(rng);
+                double kind = uniform(rng);
+
+                if (kind < 0.5) {
+                    Track* track = (Track*) tracks->ConstructedAt(track_index++);
+                    set_track(track, pt, eta, phi, uniform(rng) < 0.5 ? 1 : -1);
+                    jet->Constituents.Add(track);
+                    charged++;
+                } else if (kind < 0.8) {
+                    Tower* tower = (Tower*) photons->ConstructedAt(photon_index++);
+                    set_tower(tower, pt, eta, phi, 1.);
+                    jet->Constituents.Add(tower);
+                    neutrals++;
+                } else {
+                    Tower* tower = (Tower*) hadrons->ConstructedAt(hadron_index++);
+                    set_tower(tower, pt, eta, phi, 0.1 * uniform(rng));
+                    jet->Constituents.Add(tower);
+                    neutrals++;
+                }
+            }
+            jet->NCharged = charged;
+            jet->NNeutrals = neutrals;
+
+            Jet* genJet = (Jet*) genJets->ConstructedAt(j);
+            genJet->Constituents.Clear();
+            genJet->PT = jet->PT * (1. + smear(rng));
+            genJet->Eta = axis.eta + smear(rng);
+            genJet->Phi = wrap_phi(axis.phi + smear(rng));
+            genJet->Mass = jet->Mass;
+        }
+
+        // Pile-up and underlying event outside of the jets
+        for (int t = track_index, n = std::max(track_index, n_tracks(rng)); t < n; ++t)
+            set_track((Track*) tracks->ConstructedAt(t), 0.2 + soft_pt(rng), flat_eta(rng), flat_phi(rng),
+                      uniform(rng) < 0.5 ? 1 : -1);
+        for (int t = photon_index + hadron_index, n = std::max(t, n_towers(rng)); t < n; ++t) {
+            if (uniform(rng) < 0.5)
+                set_tower((Tower*) photons->ConstructedAt(photon_index++), 0.2 + soft_pt(rng), flat_eta(rng), flat_phi(rng), 1.);
+            else
+                set_tower((Tower*) hadrons->ConstructedAt(hadron_index++), 0.2 + soft_pt(rng), flat_eta(rng), flat_phi(rng), 0.1);
+        }
+
+        int particle_index = 0;
+        if (config.signal) {
+            // W -> Ds gamma, with the Ds inside the first jet
+            Axis axis = axes.front();
+            set_particle((GenParticle*) particles->ConstructedAt(particle_index++), 24, 22, -1, 1, 2,
+                         10. * uniform(rng), axis.eta - 0.5, axis.phi + 2., 80.4);
+            set_particle((GenParticle*) particles->ConstructedAt(particle_index++), 431, 2, 0, -1, -1,
+                         30. + jet_pt(rng), axis.eta + 0.5 * smear(rng), axis.phi + 0.5 * smear(rng), 1.968);
+            set_particle((GenParticle*) particles->ConstructedAt(particle_index++), 22, 1, 0, -1, -1,
+                         30. + jet_pt(rng), -axis.eta, axis.phi + M_PI, 0.);
+        }
+        for (int p = particle_index, n = std::max(particle_index, n_particles(rng)); p < n; ++p) {
+            int mother = p > 2 ? (int) (uniform(rng) * p) : -1;
+            set_particle((GenParticle*) particles->ConstructedAt(p), uniform(rng) < 0.3 ? 111 : 211, 1,
+                         mother, -1, -1, soft_pt(rng), flat_eta(rng), flat_phi(rng), 0.135);
+        }
+
+        tree->Fill();
+        TProcessID::SetObjectCount(object_count);
+    }
+
+    return tree;
+}
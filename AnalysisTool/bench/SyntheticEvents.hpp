@@ -0,0 +1,25 @@
+#pragma once
+
+#include "TTree.h"
+#include "TDirectory.h"
+
+
+// Multiplicities are Poisson means per event (per jet for the constituents).
+struct SyntheticConfig
+{
+    unsigned long seed = 20220101;
+    long long events = 2000;
+    bool signal = false;
+    double jets = 6.;
+    double constituents = 25.;
+    double tracks = 150.;
+    double towers = 250.;
+    double particles = 600.;
+};
+
+
+// Fills a Delphes-like "Delphes" tree in `dir` with the Jet, GenJet,
+// EFlowTrack, EFlowPhoton, EFlowNeutralHadron and Particle branches used by the
+// tools. Jet constituents are TRefs into the EFlow collections, signal events
+// carry a W -> Ds gamma decay in the truth record.
+TTree* GenerateSyntheticEvents(const SyntheticConfig& config, TDirectory* dir);
@@ -0,0 +1,186 @@
+#include "SyntheticEvents.hpp"
+
+#include "analysis/io/EventReader.hpp"
+#include "analysis/ntupler/NTupler.hpp"
+#include "analysis/truth/EventConsistency.hpp"
+
+#include "TMemFile.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+
+struct KernelTiming
+{
+    std::string name;
+    long long calls = 0;
+    double seconds = std::numeric_limits<double>::max();
+};
+
+
+// Times the NTupler kernels one by one on already read events. Every pass
+// reads all events again, the fastest of the passes is reported.
+class NTuplerBenchmark
+{
+  private:
+    typedef std::chrono::steady_clock clock;
+
+    template <typename F>
+    static double Time(F&& kernel) {
+        auto start = clock::now();
+        kernel();
+        return std::chrono::duration<double>(clock::now() - start).count();
+    }
+
+    static void Keep(KernelTiming& timing, long long calls, double seconds) {
+        if (seconds < timing.seconds) {
+            timing.calls = calls;
+            timing.seconds = seconds;
+        }
+    }
+
+  public:
+    static std::vector<KernelTiming> Run(TTree* background, TTree* signal, TDirectory* scratch, int repeat) {
+        KernelTiming background_jets{"NTupler::GetBackgroundEventJets"};
+        KernelTiming signal_jets{"NTupler::GetSignalEventJets"};
+        KernelTiming decay_graph{"EventReader::GetDecayGraph"};
+        KernelTiming get_ds{"TruthEventConsistency::GetDS"};
+        KernelTiming resolve{"JetConstituents::Fill"};
+        KernelTiming image{"JetFeatures::FillImages"};
+        KernelTiming constituents{"JetFeatures::Substructure"};
+        KernelTiming cones{"JetFeatures::TrackCones"};
+
+        TDirectory::TContext context(scratch);
+
+        EventReader background_reader(background);
+        NTupler background_ntupler("BackgroundQQ", &background_reader);
+
+        EventReader signal_reader(signal);
+        NTupler signal_ntupler("SignalWplus", &signal_reader);
+        TruthEventConsistency consistency(&signal_reader);
+
+        JetRecord record;
+        record.images = background_ntupler.br_jet_images;
+        JetImager imager = background_ntupler.imager;
+
+        for (int pass = 0; pass < repeat; ++pass) {
+            double t_background = 0, t_resolve = 0, t_image = 0, t_constituents = 0, t_cones = 0;
+            long long n_events = background_reader.GetEntries(), n_jets = 0;
+
+            for (long long entry = 0; entry < n_events; ++entry) {
+                background_reader.ReadEntry(entry);
+                NTupler& ntupler = background_ntupler;
+
+                ntupler.selected_jets.clear();
+                t_background += Time([&] { ntupler.GetBackgroundEventJets(); });
+
+                for (Jet* jet: ntupler.selected_jets) {
+                    n_jets++;
+                    record.jet = jet;
+                    record.pcone.fill(0.0);
+                    t_resolve += Time([&] { record.constituents.Fill(jet); });
+                    t_image += Time([&] { JetFeatures::FillImages(imager, record); });
+                    t_constituents += Time([&] { JetFeatures::Substructure(record); });
+                    t_cones += Time([&] {
+                        JetFeatures::TrackCones(background_reader.GetEventView().tracks.pt, background_reader.GetTrackGrid(), record);
+                    });
+                }
+            }
+
+            Keep(background_jets, n_events, t_background);
+            Keep(resolve, n_jets, t_resolve);
+            Keep(image, n_jets, t_image);
+            Keep(constituents, n_jets, t_constituents);
+            Keep(cones, n_jets, t_cones);
+
+            double t_graph = 0, t_signal = 0, t_ds = 0;
+            n_events = signal_reader.GetEntries();
+
+            for (long long entry = 0; entry < n_events; ++entry) {
+                signal_reader.ReadEntry(entry);
+
+                // Built once per event, the kernels below reuse it
+                t_graph += Time([&] { signal_reader.GetDecayGraph(); });
+
+                signal_ntupler.selected_jets.clear();
+                t_signal += Time([&] { signal_ntupler.GetSignalEventJets(); });
+                t_ds += Time([&] { consistency.GetDS(); });
+            }
+
+            Keep(decay_graph, n_events, t_graph);
+            Keep(signal_jets, n_events, t_signal);
+            Keep(get_ds, n_events, t_ds);
+        }
+
+        return {background_jets, decay_graph, signal_jets, get_ds, resolve, image, constituents, cones};
+    }
+};
+
+
+int main(int argc, char* argv[]) {
+    SyntheticConfig config;
+    int repeat = 5;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg(argv[i]);
+        if (i + 1 >= argc) {
+            std::cout << "Missing value for " << arg << "." << std::endl;
+            return 1;
+        }
+
+        if (arg == "--events") config.events = std::atoll(argv[++i]);
+        else if (arg == "--seed") config.seed = std::strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--jets") config.jets = std::atof(argv[++i]);
+        else if (arg == "--constituents") config.constituents = std::atof(argv[++i]);
+        else if (arg == "--tracks") config.tracks = std::atof(argv[++i]);
+        else if (arg == "--towers") config.towers = std::atof(argv[++i]);
+        else if (arg == "--particles") config.particles = std::atof(argv[++i]);
+        else if (arg == "--repeat") repeat = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--kernels" && SubstructureKernels::ParseMode(argv[i + 1], SubstructureKernels::mode)) ++i;
+        else {
+            std::cout << "Usage: " << argv[0] << " [--events N] [--seed S] [--jets N] [--constituents N]"
+                << " [--tracks N] [--towers N] [--particles N] [--repeat N] [--kernels auto|scalar|avx2]" << std::endl;
+            return 1;
+        }
+    }
+
+    TMemFile background_file("synthetic_background.root", "RECREATE");
+    TMemFile signal_file("synthetic_signal.root", "RECREATE");
+    TMemFile scratch("benchmark_scratch.root", "RECREATE");
+
+    std::cout << "** Generating " << config.events << " background and signal events (seed " << config.seed << ")." << std::endl;
+    config.signal = false;
+    TTree* background = GenerateSyntheticEvents(config, &background_file);
+    config.signal = true;
+    TTree* signal = GenerateSyntheticEvents(config, &signal_file);
+
+    auto timings = NTuplerBenchmark::Run(background, signal, &scratch, repeat);
+
+    std::cout << "** Best of " << repeat << " passes" << std::endl;
+    std::cout << "** " << std::left << std::setw(36) << "Kernel" << std::right << std::setw(12) << "calls"
+        << std::setw(14) << "ns/call" << std::setw(16) << "calls/s" << std::endl;
+
+    double jet_seconds = 0;
+    long long jets = 0;
+    for (auto& timing: timings) {
+        std::cout << "** " << std::left << std::setw(36) << timing.name << std::right << std::setw(12) << timing.calls
+            << std::setw(14) << std::fixed << std::setprecision(1) << timing.seconds * 1e9 / std::max(1ll, timing.calls)
+            << std::setw(16) << std::setprecision(0) << timing.calls / timing.seconds << std::endl;
+
+        if (timing.name == "JetConstituents::Fill" || timing.name == "JetFeatures::FillImages" ||
+            timing.name == "JetFeatures::Substructure" ||
+            timing.name == "JetFeatures::TrackCones") {
+            jet_seconds += timing.seconds;
+            jets = timing.calls;
+        }
+    }
+
+    // Headline number to compare between commits
+    std::cout << "** Throughput: " << std::setprecision(0) << jets / jet_seconds << " jets/s" << std::endl;
+    return 0;
+}
@@ -1,10 +1,37 @@
 #pragma once
 
+#include "TDirectory.h"
+
+#include <string>
+#include <vector>
+
 
 class AnalysisTool
 {
   public:
     virtual void ProcessEvent() = 0;
+    // Branch names or wildcard patterns (as for TTree::SetBranchStatus) of
+    // everything the tool reads. All other branches of the chain are disabled.
+    virtual std::vector<std::string> RequiredBranches() const = 0;
+    // Exact names of active branches that are only needed after SelectEvent
+    // accepted the event. With a staged read they are loaded in a second step,
+    // a deferred top-level branch postpones all of its sub-branches.
+    virtual std::vector<std::string> DeferredBranches() const { return {}; }
+    // Cheap pre-selection on the non-deferred branches; ProcessEvent is only
+    // called for accepted events.
+    virtual bool SelectEvent() { return true; }
+    // True once the tool needs no further events. The event loop stops
+    // reading when every tool is saturated.
+    virtual bool Saturated() const { return false; }
+    // Add the output of an identically configured tool, which was run on a
+    // later part of the chain and wrote its objects into `partial`.
+    virtual void Merge(TDirectory* partial) = 0;
+    // True if the tool would be saturated after Merge(partial).
+    virtual bool SaturatedAfterMerge(TDirectory* /*partial*/) const { return Saturated(); }
+    // Completes output still in flight after the last ProcessEvent, called
+    // once the event loop ended and before any report. Merge must do the same
+    // for the tool's own output before adding the partial one.
+    virtual void Flush() {}
     virtual void Finalize() = 0;
     virtual ~AnalysisTool()=default;
-};
\ No newline at end of file
+};
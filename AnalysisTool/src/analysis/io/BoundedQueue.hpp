@@ -0,0 +1,102 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+
+// Single producer, single consumer ring of reusable slots. The producer
+// fills a slot in place and publishes it, the consumer reads and releases
+// it; neither side takes a lock. A waiting side yields first, then sleeps,
+// so an idle consumer does not hold a core.
+template <typename T>
+class BoundedQueue
+{
+  private:
+    std::vector<T> slots;
+    // Slots published and released so far, head - tail is the depth
+    std::atomic<size_t> head;
+    std::atomic<size_t> tail;
+    std::atomic<bool> closed;
+
+    // Producer side statistics
+    size_t pushes;
+    size_t depth_sum;
+    size_t max_depth;
+    double wait_seconds;
+
+    static void Backoff(int& spins) {
+        if (++spins < 64)
+            std::this_thread::yield();
+        else
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+
+  public:
+    explicit BoundedQueue(size_t capacity):
+        slots(std::max<size_t>(capacity, 1)), head(0), tail(0), closed(false),
+        pushes(0), depth_sum(0), max_depth(0), wait_seconds(0.) {}
+
+    size_t Capacity() const { return slots.size(); }
+
+    // Producer: waits for a free slot and returns it to be filled
+    T& Acquire() {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) == slots.size()) {
+            auto start = std::chrono::steady_clock::now();
+            int spins = 0;
+            while (h - tail.load(std::memory_order_acquire) == slots.size())
+                Backoff(spins);
+            wait_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        size_t depth = h - tail.load(std::memory_order_relaxed);
+        pushes++;
+        depth_sum += depth;
+        max_depth = std::max(max_depth, depth + 1);
+        return slots[h % slots.size()];
+    }
+
+    // Producer: hands the acquired slot to the consumer
+    void Publish() {
+        head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // Producer: no more slots follow
+    void Close() {
+        closed.store(true, std::memory_order_release);
+    }
+
+    // Producer: once the consumer returned from Front, slots may follow for
+    // a new consumer
+    void Reopen() {
+        closed.store(false, std::memory_order_release);
+    }
+
+    // Consumer: waits for a published slot, nullptr once the queue is closed and empty
+    T* Front() {
+        size_t t = tail.load(std::memory_order_relaxed);
+        int spins = 0;
+        while (head.load(std::memory_order_acquire) == t) {
+            if (closed.load(std::memory_order_acquire) && head.load(std::memory_order_acquire) == t)
+                return nullptr;
+            Backoff(spins);
+        }
+        return &slots[t % slots.size()];
+    }
+
+    // Consumer: releases the front slot
+    void Pop() {
+        tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // Producer side statistics, the depth is counted before each push
+    size_t Pushes() const { return pushes; }
+    double MeanDepth() const { return pushes ? (double) depth_sum / pushes : 0.; }
+    size_t MaxDepth() const { return max_depth; }
+    // Time the producer waited for a free slot
+    double WaitSeconds() const { return wait_seconds; }
+};
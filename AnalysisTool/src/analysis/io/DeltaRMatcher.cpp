@@ -0,0 +1,147 @@
+#include "analysis/io/DeltaRMatcher.hpp"
+#include "analysis/io/EventView.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <numeric>
+
+
+// Cost of a pair outside the cut, above any sum of delta R within it
+#define MATCH_OUTSIDE_COST 1e6
+
+
+void DeltaRMatcher::Clear() {
+    unsorted_eta.clear();
+    unsorted_phi.clear();
+    unsorted_index.clear();
+    eta.clear();
+    phi.clear();
+    index.clear();
+}
+
+void DeltaRMatcher::Add(double eta, double phi, long long index) {
+    unsorted_eta.push_back(eta);
+    unsorted_phi.push_back(phi);
+    unsorted_index.push_back(index);
+}
+
+void DeltaRMatcher::Build() {
+    size_t n = unsorted_index.size();
+    order.resize(n);
+    std::iota(order.begin(), order.end(), 0);
+    // Stable, so candidates at equal eta stay in input order
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return unsorted_eta[a] < unsorted_eta[b]; });
+
+    eta.resize(n);
+    phi.resize(n);
+    index.resize(n);
+    for (size_t k = 0; k < n; ++k) {
+        eta[k] = unsorted_eta[order[k]];
+        phi[k] = unsorted_phi[order[k]];
+        index[k] = unsorted_index[order[k]];
+    }
+}
+
+long long DeltaRMatcher::Nearest(double target_eta, double target_phi, double max_dr, double* delta_r) const {
+    auto first = std::lower_bound(eta.begin(), eta.end(), target_eta - max_dr);
+    auto last = std::upper_bound(first, eta.end(), target_eta + max_dr);
+
+    double min_r = max_dr;
+    long long best = -1;
+    size_t best_order = 0;
+    for (size_t k = first - eta.begin(); k < (size_t) (last - eta.begin()); ++k) {
+        double r = DeltaR(eta[k], phi[k], target_eta, target_phi);
+        // order[k] is the input position, which breaks ties
+        if (r < min_r || (r == min_r && best >= 0 && order[k] < best_order)) {
+            min_r = r;
+            best = index[k];
+            best_order = order[k];
+        }
+    }
+
+    if (delta_r != nullptr && best >= 0)
+        *delta_r = min_r;
+    return best;
+}
+
+std::vector<long long> DeltaRMatcher::MatchOneToOne(const std::vector<double>& target_eta,
+                                                    const std::vector<double>& target_phi, double max_dr) {
+    size_t targets = target_eta.size();
+    size_t candidates = index.size();
+    std::vector<long long> result(targets, -1);
+    if (targets == 0 || candidates == 0) return result;
+
+    // Hungarian algorithm on rows <= columns, transposed if there are more targets
+    bool transposed = targets > candidates;
+    size_t rows = transposed ? candidates : targets;
+    size_t columns = transposed ? targets : candidates;
+
+    cost.assign(rows * columns, MATCH_OUTSIDE_COST);
+    for (size_t t = 0; t < targets; ++t) {
+        auto first = std::lower_bound(eta.begin(), eta.end(), target_eta[t] - max_dr);
+        auto last = std::upper_bound(first, eta.end(), target_eta[t] + max_dr);
+        for (size_t k = first - eta.begin(); k < (size_t) (last - eta.begin()); ++k) {
+            double r = DeltaR(eta[k], phi[k], target_eta[t], target_phi[t]);
+            if (r < max_dr)
+                cost[transposed ? k * columns + t : t * columns + k] = r;
+        }
+    }
+
+    // Potentials and augmenting paths, 1-based with column 0 as the free root
+    const double infinity = std::numeric_limits<double>::infinity();
+    u.assign(rows + 1, 0.);
+    v.assign(columns + 1, 0.);
+    assigned.assign(columns + 1, 0);
+    way.assign(columns + 1, 0);
+
+    for (size_t row = 1; row <= rows; ++row) {
+        assigned[0] = row;
+        size_t column = 0;
+        way_cost.assign(columns + 1, infinity);
+        used.assign(columns + 1, false);
+
+        do {
+            used[column] = true;
+            size_t current_row = assigned[column], next_column = 0;
+            double delta = infinity;
+            for (size_t c = 1; c <= columns; ++c) {
+                if (used[c]) continue;
+                double reduced = cost[(current_row - 1) * columns + c - 1] - u[current_row] - v[c];
+                if (reduced < way_cost[c]) {
+                    way_cost[c] = reduced;
+                    way[c] = column;
+                }
+                if (way_cost[c] < delta) {
+                    delta = way_cost[c];
+                    next_column = c;
+                }
+            }
+            for (size_t c = 0; c <= columns; ++c) {
+                if (used[c]) {
+                    u[assigned[c]] += delta;
+                    v[c] -= delta;
+                } else {
+                    way_cost[c] -= delta;
+                }
+            }
+            column = next_column;
+        } while (assigned[column] != 0);
+
+        do {
+            size_t previous = way[column];
+            assigned[column] = assigned[previous];
+            column = previous;
+        } while (column != 0);
+    }
+
+    for (size_t c = 1; c <= columns; ++c) {
+        if (assigned[c] == 0) continue;
+        size_t row = assigned[c] - 1;
+        if (cost[row * columns + c - 1] >= MATCH_OUTSIDE_COST) continue;
+
+        size_t t = transposed ? c - 1 : row;
+        size_t k = transposed ? row : c - 1;
+        result[t] = index[k];
+    }
+    return result;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+
+// Matches targets (truth objects, GenJets) to pre-filtered candidates (jets)
+// in eta-phi. Candidates are sorted by eta once, so a lookup only computes
+// delta R for the candidates inside the eta window of the cut. Candidates
+// keep the index they were added with; equal distances resolve to the
+// candidate added first, as a scan in input order keeping the first minimum.
+class DeltaRMatcher
+{
+  private:
+    // Sorted by eta
+    std::vector<double> eta;
+    std::vector<double> phi;
+    std::vector<long long> index;
+    std::vector<size_t> order;
+
+    std::vector<double> unsorted_eta;
+    std::vector<double> unsorted_phi;
+    std::vector<long long> unsorted_index;
+
+    // Assignment scratch
+    std::vector<double> cost;
+    std::vector<double> u, v, way_cost;
+    std::vector<int> assigned, way;
+    std::vector<char> used;
+
+  public:
+    void Clear();
+    void Add(double eta, double phi, long long index);
+    // Sorts the added candidates, before any lookup.
+    void Build();
+    size_t Size() const { return index.size(); }
+
+    // Index of the nearest candidate with delta R < max_dr from (eta, phi),
+    // -1 if there is none.
+    long long Nearest(double eta, double phi, double max_dr, double* delta_r = nullptr) const;
+
+    // Candidate index for every target, -1 if unmatched. Every candidate is
+    // used at most once: the assignment maximises the number of pairs within
+    // max_dr, then minimises their summed delta R.
+    std::vector<long long> MatchOneToOne(const std::vector<double>& target_eta, const std::vector<double>& target_phi,
+                                         double max_dr);
+};
@@ -0,0 +1,51 @@
+#include "analysis/io/EtaPhiGrid.hpp"
+
+#include <algorithm>
+
+
+EtaPhiGrid::EtaPhiGrid(double cell_size, double eta_max): eta_max(eta_max) {
+    n_eta = std::max(1, (int) std::ceil(2. * eta_max / cell_size));
+    eta_cell = 2. * eta_max / n_eta;
+    // Whole number of columns so the wrap-around lines up
+    n_phi = std::max(1, (int) std::floor(2. * M_PI / cell_size));
+    phi_cell = 2. * M_PI / n_phi;
+
+    cell_start.assign(n_eta * n_phi + 1, 0);
+}
+
+int EtaPhiGrid::EtaRow(double value) const {
+    int row = (int) std::floor((value + eta_max) / eta_cell);
+    return std::min(std::max(row, 0), n_eta - 1);
+}
+
+int EtaPhiGrid::PhiColumn(double value) const {
+    int column = (int) std::floor((value + M_PI) / phi_cell);
+    return ((column % n_phi) + n_phi) % n_phi;
+}
+
+void EtaPhiGrid::Build(const KinematicColumns& columns) {
+    size_t n = columns.Size();
+
+    std::vector<int> cells(n);
+    std::fill(cell_start.begin(), cell_start.end(), 0);
+    for (size_t i = 0; i < n; ++i) {
+        cells[i] = EtaRow(columns.eta[i]) * n_phi + PhiColumn(columns.phi[i]);
+        cell_start[cells[i] + 1]++;
+    }
+
+    for (size_t c = 1; c < cell_start.size(); ++c)
+        cell_start[c] += cell_start[c - 1];
+
+    index.resize(n);
+    eta.resize(n);
+    phi.resize(n);
+
+    // Filling in input order keeps every cell in input order
+    std::vector<int> next(cell_start.begin(), cell_start.end() - 1);
+    for (size_t i = 0; i < n; ++i) {
+        int k = next[cells[i]]++;
+        index[k] = i;
+        eta[k] = columns.eta[i];
+        phi[k] = columns.phi[i];
+    }
+}
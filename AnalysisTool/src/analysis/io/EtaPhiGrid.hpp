@@ -0,0 +1,66 @@
+#pragma once
+
+#include "analysis/io/EventView.hpp"
+
+#include <cmath>
+#include <vector>
+
+
+// Binned eta-phi index over one collection of the EventView, built once per
+// entry. Answers cone queries by visiting only the cells overlapping the
+// cone, with phi wrapping around. Objects beyond |eta| > eta_max share the
+// edge rows.
+class EtaPhiGrid
+{
+  private:
+    double eta_max;
+    double eta_cell;
+    double phi_cell;
+    int n_eta;
+    int n_phi;
+
+    // Counting sort by cell: objects of cell c are [cell_start[c], cell_start[c+1])
+    std::vector<int> cell_start;
+    std::vector<int> index;
+    std::vector<double> eta;
+    std::vector<double> phi;
+
+    int EtaRow(double value) const;
+    int PhiColumn(double value) const;
+
+  public:
+    EtaPhiGrid(double cell_size = 0.4, double eta_max = 2.5);
+
+    void Build(const KinematicColumns& columns);
+
+    // Calls f(i, delta_r) for every object i of the columns with
+    // delta_r < radius from (axis_eta, axis_phi).
+    template <typename F>
+    void ForEachWithin(double axis_eta, double axis_phi, double radius, F&& f) const;
+};
+
+
+template <typename F>
+void EtaPhiGrid::ForEachWithin(double axis_eta, double axis_phi, double radius, F&& f) const {
+    if (index.empty()) return;
+
+    int row_first = EtaRow(axis_eta - radius);
+    int row_last = EtaRow(axis_eta + radius);
+    int column_first = (int) std::floor((axis_phi - radius + M_PI) / phi_cell);
+    int column_last = (int) std::floor((axis_phi + radius + M_PI) / phi_cell);
+    // A cone wider than the whole phi range must not visit cells twice
+    if (column_last - column_first >= n_phi)
+        column_last = column_first + n_phi - 1;
+
+    for (int row = row_first; row <= row_last; ++row) {
+        for (int column = column_first; column <= column_last; ++column) {
+            int cell = row * n_phi + ((column % n_phi) + n_phi) % n_phi;
+
+            for (int k = cell_start[cell]; k < cell_start[cell + 1]; ++k) {
+                double delta_r = DeltaR(axis_eta, axis_phi, eta[k], phi[k]);
+                if (delta_r < radius)
+                    f(index[k], delta_r);
+            }
+        }
+    }
+}
@@ -0,0 +1,273 @@
+#include "analysis/io/EventReader.hpp"
+#include "analysis/profiling/Profiler.hpp"
+
+#include "TChainElement.h"
+#include "TFile.h"
+#include "TROOT.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fcntl.h>
+#include <unistd.h>
+
+
+EventReader::EventReader(std::string in_file) {
+    TChain* files = new TChain("Delphes");
+    files->Add(in_file.c_str());
+
+    chain = files;
+    owns_chain = true;
+    treeReader = new ExRootTreeReader(chain);
+    current_tree = -1;
+    current_entry = -1;
+    cache_first = 0;
+    cache_last = -1;
+    input_seconds = 0.;
+    particles = nullptr;
+    decay_graph_valid = false;
+    track_grid_valid = false;
+}
+
+EventReader::EventReader(TTree* tree) {
+    chain = tree;
+    owns_chain = false;
+    treeReader = new ExRootTreeReader(chain);
+    current_tree = -1;
+    current_entry = -1;
+    cache_first = 0;
+    cache_last = -1;
+    input_seconds = 0.;
+    particles = nullptr;
+    decay_graph_valid = false;
+    track_grid_valid = false;
+}
+
+EventReader::~EventReader() {
+    if (open_ahead.joinable())
+        open_ahead.join();
+    delete treeReader;
+    if (owns_chain)
+        delete chain;
+}
+
+TClonesArray* EventReader::UseBranch(const std::string& name) {
+    auto it = used_branches.find(name);
+    if (it != used_branches.end()) return it->second;
+
+    TClonesArray* array = treeReader->UseBranch(name.c_str());
+    used_branches[name] = array;
+    return array;
+}
+
+const Int_t* EventReader::UseBranchSize(const std::string& name) {
+    std::string size_name = name + "_size";
+    auto it = branch_sizes.find(size_name);
+    if (it != branch_sizes.end()) return &it->second;
+
+    Int_t* size = &branch_sizes[size_name];
+    *size = 0;
+    chain->SetBranchAddress(size_name.c_str(), size);
+    current_tree = -1;
+    return size;
+}
+
+long long EventReader::GetEntries() {
+    return treeReader->GetEntries();
+}
+
+std::vector<std::string> EventReader::GetFileNames() {
+    std::vector<std::string> names;
+    TChain* files_chain = dynamic_cast<TChain*>(chain);
+    if (files_chain == nullptr) return names;
+
+    TObjArray* files = files_chain->GetListOfFiles();
+
+    for (int i = 0; i < files->GetEntriesFast(); ++i)
+        names.emplace_back(((TChainElement*) files->At(i))->GetTitle());
+    return names;
+}
+
+void EventReader::SetActiveBranches(const std::vector<std::string>& branches, const std::vector<std::string>& deferred_branches) {
+    chain->SetBranchStatus("*", 0);
+
+    for (auto& branch: branches)
+        chain->SetBranchStatus(branch.c_str(), 1);
+    for (auto& branch: deferred_branches)
+        chain->SetBranchStatus(branch.c_str(), 1);
+
+    // Sub-branches of a deferred branch are only read by ReadDeferred
+    active_names.clear();
+    for (auto& branch: branches) {
+        bool is_deferred = std::any_of(deferred_branches.begin(), deferred_branches.end(), [&](const std::string& name) {
+            return branch == name || branch.compare(0, name.size() + 1, name + ".") == 0;
+        });
+        if (!is_deferred)
+            active_names.push_back(branch);
+    }
+    deferred_names = deferred_branches;
+    current_tree = -1;
+}
+
+void EventReader::SetReadOptions(const ReadOptions& options, long long first, long long last) {
+    read_options = options;
+    cache_first = first;
+    cache_last = last;
+    current_tree = -1;
+}
+
+void EventReader::ConfigureTree() {
+    // The deferred branches are looked up and switched off again
+    deferred.clear();
+    for (auto& name: deferred_names) {
+        TBranch* branch = chain->GetBranch(name.c_str());
+        if (branch == nullptr) continue;
+
+        branch->SetBit(TBranch::kDoNotProcess);
+        deferred.push_back(branch);
+    }
+
+    // ExRootTreeReader only loads the collections it knows
+    size_branches.clear();
+    for (auto& size: branch_sizes) {
+        TBranch* branch = chain->GetBranch(size.first.c_str());
+        if (branch != nullptr)
+            size_branches.push_back(branch);
+    }
+
+    // Switching parallel unzipping replaces the cache by a new one, so it
+    // comes before the cache is sized and filled. It runs in ROOT's implicit
+    // multithreading pool, which only single threaded runs enable.
+    if (read_options.cache_mb > 0)
+        chain->SetParallelUnzip(read_options.prefetch && ROOT::IsImplicitMTEnabled());
+
+    // The cache holds the branches read for every entry, known up front so
+    // there is no learning phase. The deferred branches are only read for
+    // selected entries and stay out of it.
+    chain->SetCacheSize(read_options.cache_mb * 1024LL * 1024LL);
+    if (read_options.cache_mb > 0) {
+        for (auto& name: active_names)
+            chain->AddBranchToCache(name.c_str(), true);
+        // A wildcard pattern may still cover a deferred branch
+        for (auto& name: deferred_names)
+            chain->DropBranchFromCache(name.c_str(), true);
+        chain->StopCacheLearningPhase();
+        if (cache_last >= 0)
+            chain->SetCacheEntryRange(cache_first, cache_last);
+    }
+
+    if (read_options.prefetch) {
+        std::vector<std::string> files = GetFileNames();
+        if (current_tree + 1 < (int) files.size())
+            OpenAhead(files[current_tree + 1]);
+    }
+}
+
+void EventReader::OpenAhead(const std::string& file_name) {
+    if (open_ahead.joinable())
+        open_ahead.join();
+
+    // About the first cache fill of the file, not the whole file
+    off_t read_ahead = read_options.cache_mb * 1024LL * 1024LL;
+    open_ahead = std::thread([file_name, read_ahead] {
+        // Local files: let the kernel read ahead the start of the file
+        int fd = read_ahead > 0 ? open(file_name.c_str(), O_RDONLY) : -1;
+        if (fd >= 0) {
+            posix_fadvise(fd, 0, read_ahead, POSIX_FADV_WILLNEED);
+            close(fd);
+        }
+
+        // Header, keys and streamer info, cached by the OS or the remote server
+        TFile* file = TFile::Open(file_name.c_str(), "READ");
+        if (file == nullptr) return;
+        file->Get<TTree>("Delphes");
+        file->Close();
+        delete file;
+    });
+}
+
+bool EventReader::ReadEntry(long long entry) {
+    PROFILE_SCOPE("EventReader::ReadEntry");
+
+    decay_graph_valid = false;
+    auto start = std::chrono::steady_clock::now();
+    current_entry = chain->LoadTree(entry);
+    if (current_entry < 0) return false;
+
+    // Loading the next file of the chain resets the branch status and the cache
+    if (chain->GetTreeNumber() != current_tree) {
+        current_tree = chain->GetTreeNumber();
+        ConfigureTree();
+    }
+
+    bool read = treeReader->ReadEntry(entry);
+    for (auto branch: size_branches)
+        read &= branch->GetEntry(current_entry) >= 0;
+    input_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (!read) return false;
+
+    FillEventView(false);
+    return true;
+}
+
+void EventReader::ReadDeferred() {
+    PROFILE_SCOPE("EventReader::ReadDeferred");
+
+    auto start = std::chrono::steady_clock::now();
+    for (auto branch: deferred) {
+        branch->ResetBit(TBranch::kDoNotProcess);
+        branch->GetEntry(current_entry);
+        branch->SetBit(TBranch::kDoNotProcess);
+    }
+    input_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    FillEventView(true);
+}
+
+TClonesArray* EventReader::GetUsedBranch(const std::string& name) {
+    auto it = used_branches.find(name);
+    return it == used_branches.end() ? nullptr : it->second;
+}
+
+void EventReader::FillEventView(bool deferred_phase) {
+    PROFILE_SCOPE("EventReader::FillEventView");
+
+    auto in_phase = [&](const std::string& name) {
+        bool is_deferred = std::find(deferred_names.begin(), deferred_names.end(), name) != deferred_names.end();
+        return deferred_phase == is_deferred;
+    };
+
+    // Deferred track columns must not keep the previous entry
+    track_grid_valid = false;
+    if (!deferred_phase)
+        view.tracks.Clear();
+
+    TClonesArray* array;
+    if ((array = GetUsedBranch("Jet")) != nullptr && in_phase("Jet"))
+        EventView::FillJets(view.jets, array);
+    if ((array = GetUsedBranch("Photon")) != nullptr && in_phase("Photon"))
+        EventView::FillPhotons(view.photons, array);
+    if ((array = GetUsedBranch("EFlowTrack")) != nullptr && in_phase("EFlowTrack"))
+        EventView::FillTracks(view.tracks, array);
+}
+
+void EventReader::UseDecayGraph() {
+    particles = UseBranch("Particle");
+}
+
+const DecayGraph& EventReader::GetDecayGraph() {
+    if (!decay_graph_valid) {
+        PROFILE_SCOPE("DecayGraph::Build");
+        decay_graph.Build(particles);
+        decay_graph_valid = true;
+    }
+    return decay_graph;
+}
+
+const EtaPhiGrid& EventReader::GetTrackGrid() {
+    if (!track_grid_valid) {
+        PROFILE_SCOPE("EtaPhiGrid::Build");
+        track_grid.Build(view.tracks);
+        track_grid_valid = true;
+    }
+    return track_grid;
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include "TChain.h"
+#include "TClonesArray.h"
+#include "external/ExRootAnalysis/ExRootTreeReader.h"
+
+#include "analysis/io/EtaPhiGrid.hpp"
+#include "analysis/io/EventView.hpp"
+#include "analysis/truth/DecayGraph.hpp"
+
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+// Input pipeline of an EventReader
+struct ReadOptions
+{
+    // TTreeCache size in MB, filled with the baskets of the branches read for
+    // every entry; 0 switches the cache off
+    int cache_mb = 64;
+    // Decompress the cached baskets in background tasks, if ROOT's implicit
+    // multithreading is enabled, and open the next file of the chain ahead
+    // of time
+    bool prefetch = false;
+};
+
+
+class EventReader
+{
+  private:
+    TTree* chain;
+    bool owns_chain;
+    ExRootTreeReader* treeReader;
+    std::map<std::string, TClonesArray*> used_branches;
+    // The `<name>_size` counters of UseBranchSize, loaded by ReadEntry
+    std::map<std::string, Int_t> branch_sizes;
+    std::vector<TBranch*> size_branches;
+
+    // The branches read for every entry, and those only read by ReadDeferred
+    std::vector<std::string> active_names;
+    std::vector<std::string> deferred_names;
+    std::vector<TBranch*> deferred;
+    int current_tree;
+    long long current_entry;
+
+    ReadOptions read_options;
+    long long cache_first, cache_last;
+    // Opens the next file of the chain while the current one is read
+    std::thread open_ahead;
+    double input_seconds;
+
+    EventView view;
+    EtaPhiGrid track_grid;
+    bool track_grid_valid;
+
+    TClonesArray* particles;
+    DecayGraph decay_graph;
+    bool decay_graph_valid;
+
+    TClonesArray* GetUsedBranch(const std::string& name);
+    void FillEventView(bool deferred_phase);
+    // Set up for every file of the chain, as loading a file resets its branches
+    void ConfigureTree();
+    void OpenAhead(const std::string& file_name);
+
+  public:
+    EventReader(std::string in_file);
+    // Reads an existing tree, which stays owned by the caller.
+    EventReader(TTree* tree);
+    ~EventReader();
+
+    ExRootTreeReader* GetTreeReader() { return treeReader; }
+    // Like ExRootTreeReader::UseBranch, but tools asking for the same branch
+    // share one array.
+    TClonesArray* UseBranch(const std::string& name);
+    // The number of objects of a collection in the current entry, read from
+    // its `<name>_size` branch without the collection itself. Tools require
+    // the `<name>_size` branch.
+    const Int_t* UseBranchSize(const std::string& name);
+    long long GetEntries();
+    std::vector<std::string> GetFileNames();
+    // Disables every branch of the chain except the given names/patterns.
+    // The deferred branches are skipped by ReadEntry and only loaded by
+    // ReadDeferred.
+    void SetActiveBranches(const std::vector<std::string>& branches, const std::vector<std::string>& deferred_branches);
+    // Read pipeline for the entries [first, last), applied from the next ReadEntry
+    void SetReadOptions(const ReadOptions& options, long long first, long long last);
+    bool ReadEntry(long long entry);
+    void ReadDeferred();
+    // Time spent in ReadEntry and ReadDeferred loading and decompressing
+    // baskets, rather than processing them
+    double InputSeconds() const { return input_seconds; }
+
+    // Kinematics of the used Jet, Photon and EFlowTrack collections. Deferred
+    // collections are only filled once ReadDeferred was called for the entry.
+    // The EFlow towers are only reached through jet constituents, which
+    // JetConstituents resolves itself.
+    const EventView& GetEventView() const { return view; }
+    // Eta-phi index over the EventView tracks, built on first use per entry.
+    const EtaPhiGrid& GetTrackGrid();
+
+    // Truth record index of the current entry, built on first use and shared
+    // by all tools. Tools call UseDecayGraph from their constructor and
+    // require DecayGraph::RequiredBranches().
+    void UseDecayGraph();
+    const DecayGraph& GetDecayGraph();
+};
@@ -0,0 +1,50 @@
+#include "analysis/io/EventView.hpp"
+
+#include "classes/DelphesClasses.h"
+
+
+void KinematicColumns::Clear() {
+    for (auto column: {&pt, &eta, &phi, &mass, &e, &sin_phi, &cos_phi, &cosh_eta})
+        column->clear();
+}
+
+void KinematicColumns::Add(double pt, double eta, double phi, double mass, double e) {
+    this->pt.push_back(pt);
+    this->eta.push_back(eta);
+    this->phi.push_back(phi);
+    this->mass.push_back(mass);
+    this->e.push_back(e);
+    sin_phi.push_back(std::sin(phi));
+    cos_phi.push_back(std::cos(phi));
+    cosh_eta.push_back(std::cosh(eta));
+}
+
+// Energy of a (pt, eta, m) vector, as TLorentzVector::SetPtEtaPhiM computes it
+static double Energy(double pt, double eta, double mass) {
+    double p = pt * std::cosh(eta);
+    return std::sqrt(p * p + mass * mass);
+}
+
+void EventView::FillJets(KinematicColumns& columns, TClonesArray* jets) {
+    columns.Clear();
+    for (long long i = 0; i < jets->GetEntriesFast(); ++i) {
+        Jet* jet = (Jet*) jets->At(i);
+        columns.Add(jet->PT, jet->Eta, jet->Phi, jet->Mass, Energy(jet->PT, jet->Eta, jet->Mass));
+    }
+}
+
+void EventView::FillPhotons(KinematicColumns& columns, TClonesArray* photons) {
+    columns.Clear();
+    for (long long i = 0; i < photons->GetEntriesFast(); ++i) {
+        Photon* photon = (Photon*) photons->At(i);
+        columns.Add(photon->PT, photon->Eta, photon->Phi, 0., Energy(photon->PT, photon->Eta, 0.));
+    }
+}
+
+void EventView::FillTracks(KinematicColumns& columns, TClonesArray* tracks) {
+    columns.Clear();
+    for (long long i = 0; i < tracks->GetEntriesFast(); ++i) {
+        Track* track = (Track*) tracks->At(i);
+        columns.Add(track->PT, track->Eta, track->Phi, track->Mass, Energy(track->PT, track->Eta, track->Mass));
+    }
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "TClonesArray.h"
+
+#include <cmath>
+#include <vector>
+
+
+// Kinematics of one collection as plain columns, index i matching entry i
+// of the source TClonesArray.
+struct KinematicColumns
+{
+    std::vector<double> pt;
+    std::vector<double> eta;
+    std::vector<double> phi;
+    std::vector<double> mass;
+    std::vector<double> e;
+    std::vector<double> sin_phi;
+    std::vector<double> cos_phi;
+    std::vector<double> cosh_eta;
+
+    size_t Size() const { return pt.size(); }
+    void Clear();
+    void Add(double pt, double eta, double phi, double mass, double e);
+};
+
+
+// Lightweight kinematics of the current entry, filled once per entry by the
+// EventReader so tools do not rebuild TLorentzVectors in their loops.
+struct EventView
+{
+    KinematicColumns jets;
+    KinematicColumns photons;
+    KinematicColumns tracks;
+
+    static void FillJets(KinematicColumns& columns, TClonesArray* jets);
+    static void FillPhotons(KinematicColumns& columns, TClonesArray* photons);
+    static void FillTracks(KinematicColumns& columns, TClonesArray* tracks);
+};
+
+
+// Same conventions as TLorentzVector::DeltaPhi/DeltaR.
+inline double DeltaPhi(double phi1, double phi2) {
+    double delta = phi1 - phi2;
+    while (delta >= M_PI) delta -= 2. * M_PI;
+    while (delta < -M_PI) delta += 2. * M_PI;
+    return delta;
+}
+
+inline double DeltaR(double eta1, double phi1, double eta2, double phi2) {
+    double delta_eta = eta1 - eta2;
+    double delta_phi = DeltaPhi(phi1, phi2);
+    return std::sqrt(delta_eta * delta_eta + delta_phi * delta_phi);
+}
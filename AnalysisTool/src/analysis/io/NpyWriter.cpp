@@ -0,0 +1,148 @@
+#include "analysis/io/NpyWriter.hpp"
+#include "analysis/profiling/Profiler.hpp"
+
+#include "TSystem.h"
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+
+
+// The header is rewritten with the final shape on Close, so it is padded to
+// a fixed size that fits any shape.
+#define NPY_HEADER_SIZE 128
+#define NPY_BUFFER_SIZE (1 << 20)
+
+
+// Quoted JSON string, the configuration may hold paths with any character
+static std::string json_string(const std::string& value) {
+    std::string quoted = "\"";
+    for (char c: value) {
+        switch (c) {
+            case '"': quoted += "\\\""; break;
+            case '\\': quoted += "\\\\"; break;
+            case '\n': quoted += "\\n"; break;
+            case '\r': quoted += "\\r"; break;
+            case '\t': quoted += "\\t"; break;
+            default:
+                if ((unsigned char) c < 0x20) {
+                    char escaped[8];
+                    snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                    quoted += escaped;
+                } else {
+                    quoted += c;
+                }
+        }
+    }
+    return quoted + "\"";
+}
+
+
+NpyWriter::NpyWriter(): rows(0) {}
+
+NpyWriter::~NpyWriter() {
+    for (auto& column: columns)
+        if (column.file != nullptr)
+            fclose(column.file);
+}
+
+bool NpyWriter::Open(const std::string& directory) {
+    gSystem->mkdir(directory.c_str(), true);
+    if (gSystem->AccessPathName(directory.c_str(), kWritePermission))
+        return false;
+    this->directory = directory;
+    return true;
+}
+
+const int* NpyWriter::CountOf(const std::string& counts) const {
+    for (auto& column: columns)
+        if (column.name == counts && column.descr == NpyType<int>::descr && column.item_shape.empty())
+            return (const int*) column.data();
+    return nullptr;
+}
+
+void NpyWriter::AddColumn(Column column) {
+    if (!column.counts.empty() && column.count == nullptr) {
+        std::cerr << "Column " << column.name << " needs the count column " << column.counts << " first." << std::endl;
+        return;
+    }
+    std::string path = directory + "/" + column.name + ".npy";
+    column.file = fopen(path.c_str(), "wb");
+    if (column.file == nullptr) {
+        std::cerr << "Error opening " << path << ", the column is not written." << std::endl;
+        return;
+    }
+    setvbuf(column.file, nullptr, _IOFBF, NPY_BUFFER_SIZE);
+    WriteHeader(column);
+    columns.push_back(column);
+}
+
+bool NpyWriter::WriteHeader(Column& column) const {
+    std::string shape = "(" + std::to_string(column.count ? column.items : rows) + ",";
+    for (size_t i = 0; i < column.item_shape.size(); ++i)
+        shape += (i ? ", " : " ") + std::to_string(column.item_shape[i]);
+    shape += ")";
+
+    std::string header = "{'descr': '" + column.descr + "', 'fortran_order': False, 'shape': " + shape + ", }";
+    // magic, version 1.0, header length, header padded with spaces and ending in a newline
+    size_t header_length = NPY_HEADER_SIZE - 10;
+    if (header.size() + 1 > header_length) return false;
+    header.append(header_length - header.size() - 1, ' ');
+    header += '\n';
+
+    const char preamble[8] = {'\x93', 'N', 'U', 'M', 'P', 'Y', 1, 0};
+    unsigned char length[2] = {(unsigned char) (header_length & 0xff), (unsigned char) (header_length >> 8)};
+
+    fseek(column.file, 0, SEEK_SET);
+    fwrite(preamble, 1, sizeof(preamble), column.file);
+    fwrite(length, 1, sizeof(length), column.file);
+    fwrite(header.data(), 1, header.size(), column.file);
+    return !ferror(column.file);
+}
+
+void NpyWriter::Append() {
+    PROFILE_SCOPE("NpyWriter::Append");
+
+    for (auto& column: columns) {
+        size_t items = 1;
+        if (column.count != nullptr) {
+            items = *column.count;
+        } else {
+            for (auto dim: column.item_shape)
+                items *= dim;
+        }
+        fwrite(column.data(), column.item_size, items, column.file);
+        column.items += items;
+    }
+    rows++;
+}
+
+bool NpyWriter::Close() {
+    if (!IsOpen()) return true;
+
+    bool success = true;
+    for (auto& column: columns) {
+        success &= WriteHeader(column);
+        success &= fclose(column.file) == 0;
+        column.file = nullptr;
+    }
+
+    std::ofstream manifest(directory + "/manifest.json");
+    manifest << "{\n  \"rows\": " << rows << ",\n  \"configuration\": " << json_string(configuration) << ",\n  \"columns\": {";
+    for (size_t i = 0; i < columns.size(); ++i) {
+        const Column& column = columns[i];
+        manifest << (i ? ",\n" : "\n") << "    " << json_string(column.name) << ": {\"dtype\": " << json_string(column.descr)
+            << ", \"shape\": [" << (column.count ? column.items : rows);
+        for (auto dim: column.item_shape)
+            manifest << ", " << dim;
+        manifest << "]";
+        if (column.count != nullptr)
+            manifest << ", \"counts\": " << json_string(column.counts);
+        manifest << "}";
+    }
+    manifest << "\n  }\n}\n";
+    success &= manifest.good();
+
+    directory.clear();
+    return success;
+}
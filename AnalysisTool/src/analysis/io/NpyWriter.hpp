@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+
+
+template <class T> struct NpyType;
+template <> struct NpyType<double> { static constexpr const char* descr = "<f8"; };
+template <> struct NpyType<float> { static constexpr const char* descr = "<f4"; };
+template <> struct NpyType<short> { static constexpr const char* descr = "<i2"; };
+template <> struct NpyType<int> { static constexpr const char* descr = "<i4"; };
+template <> struct NpyType<unsigned short> { static constexpr const char* descr = "<u2"; };
+template <> struct NpyType<unsigned char> { static constexpr const char* descr = "|u1"; };
+template <> struct NpyType<char> { static constexpr const char* descr = "|i1"; };
+
+
+// Writes a table row by row as one .npy file per column in a directory, for
+// np.load(mmap_mode='r') without any parsing. Fixed size columns have the
+// shape (rows, item_shape...). Ragged columns are flat, the number of items
+// of every row is a separate count column, so offsets are its cumulative sum.
+// A manifest.json lists the rows and every column. Headers carry the final
+// shape only after Close.
+class NpyWriter
+{
+  private:
+    struct Column
+    {
+        std::string name;
+        std::string descr;
+        size_t item_size;
+        std::vector<size_t> item_shape;
+        // Address of the current row, re-read on every Append so the source may move
+        std::function<const void*()> data;
+        // Count column of a ragged column and its value in the current row,
+        // nullptr for fixed size
+        std::string counts;
+        const int* count;
+        FILE* file;
+        long long items;
+    };
+
+    std::string directory;
+    std::string configuration;
+    std::vector<Column> columns;
+    long long rows;
+
+    void AddColumn(Column column);
+    const int* CountOf(const std::string& counts) const;
+    bool WriteHeader(Column& column) const;
+
+  public:
+    NpyWriter();
+    ~NpyWriter();
+
+    // Creates the directory, false if it cannot be written.
+    bool Open(const std::string& directory);
+    bool IsOpen() const { return !directory.empty(); }
+    // Recorded in the manifest, like the RunInfo configuration of ROOT outputs
+    void SetConfiguration(const std::string& configuration) { this->configuration = configuration; }
+
+    template <class T>
+    void AddColumn(const std::string& name, const T* data, std::vector<size_t> item_shape = {},
+                   const char* descr = NpyType<T>::descr) {
+        AddColumn({name, descr, sizeof(T), item_shape, [data] { return (const void*) data; }, "", nullptr,
+            nullptr, 0});
+    }
+
+    // counts is an int column added before, holding the items of every row.
+    template <class T>
+    void AddRaggedColumn(const std::string& name, const std::vector<T>* data, const std::string& counts) {
+        AddColumn({name, NpyType<T>::descr, sizeof(T), {}, [data] { return (const void*) data->data(); },
+            counts, CountOf(counts), nullptr, 0});
+    }
+
+    // Copies the current values of every column as a new row.
+    void Append();
+    long long Rows() const { return rows; }
+    // Finishes the headers and writes the manifest.
+    bool Close();
+};
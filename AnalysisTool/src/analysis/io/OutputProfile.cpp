@@ -0,0 +1,37 @@
+#include "analysis/io/OutputProfile.hpp"
+
+#include "Compression.h"
+
+
+bool OutputProfile::Parse(const std::string& name, OutputProfile& result) {
+    OutputProfile profile;
+    profile.name = name;
+
+    if (name == "default") {
+        // ROOT defaults, doubles everywhere
+    } else if (name == "compact") {
+        // Small files that read fast: reduced precision, ZSTD and large baskets
+        profile.compression = ROOT::CompressionSettings(ROOT::RCompressionSetting::EAlgorithm::kZSTD, 5);
+        profile.basket_size = 256000;
+        profile.reduced_precision = true;
+    } else if (name == "fast-write") {
+        // Least time in TTree::Fill: LZ4 at its fastest level, large baskets flushed rarely
+        profile.compression = ROOT::CompressionSettings(ROOT::RCompressionSetting::EAlgorithm::kLZ4, 1);
+        profile.basket_size = 512000;
+        profile.auto_flush = -100000000;
+    } else if (name == "archival") {
+        // Full precision at the best ratio, slow to write
+        profile.compression = ROOT::CompressionSettings(ROOT::RCompressionSetting::EAlgorithm::kLZMA, 8);
+        profile.basket_size = 512000;
+        profile.auto_flush = -100000000;
+    } else {
+        return false;
+    }
+
+    result = profile;
+    return true;
+}
+
+std::string OutputProfile::Describe() const {
+    return "output_profile=" + name;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <string>
+
+
+// Storage settings of the analysis output: compression of the file, basket
+// and flush sizes of the trees and whether features are stored at reduced
+// precision (float for continuous and short for integer valued features).
+struct OutputProfile
+{
+    std::string name = "default";
+    // ROOT compression settings (100 * algorithm + level), negative keeps the ROOT default
+    int compression = -1;
+    int basket_size = 32000;
+    // As TTree::SetAutoFlush, negative values are bytes
+    long long auto_flush = -30000000;
+    bool reduced_precision = false;
+
+    // default, compact, fast-write or archival
+    static bool Parse(const std::string& name, OutputProfile& result);
+    std::string Describe() const;
+};
@@ -0,0 +1,62 @@
+#include "analysis/io/RunInfo.hpp"
+
+#include "TNamed.h"
+#include "TParameter.h"
+
+#include <sstream>
+
+
+void RunInfo::Write(TDirectory* file) const {
+    TDirectory* dir = file->mkdir("RunInfo");
+
+    std::string files;
+    for (auto& name: input_files)
+        files += name + "\n";
+
+    TParameter<Long64_t> first("first_entry", first_entry);
+    TParameter<Long64_t> last("last_entry", last_entry);
+    TParameter<Long64_t> stopped("stopped_entry", stopped_entry);
+    TParameter<Long64_t> entries("chain_entries", chain_entries);
+    TNamed inputs("input_files", files.c_str());
+    TNamed config("configuration", configuration.c_str());
+
+    dir->WriteTObject(&first);
+    dir->WriteTObject(&last);
+    dir->WriteTObject(&stopped);
+    dir->WriteTObject(&entries);
+    dir->WriteTObject(&inputs);
+    dir->WriteTObject(&config);
+}
+
+bool RunInfo::Read(TDirectory* file) {
+    TDirectory* dir = file->GetDirectory("RunInfo");
+    if (dir == nullptr) return false;
+
+    auto first = dir->Get<TParameter<Long64_t>>("first_entry");
+    auto last = dir->Get<TParameter<Long64_t>>("last_entry");
+    auto stopped = dir->Get<TParameter<Long64_t>>("stopped_entry");
+    auto entries = dir->Get<TParameter<Long64_t>>("chain_entries");
+    auto inputs = dir->Get<TNamed>("input_files");
+    auto config = dir->Get<TNamed>("configuration");
+    if (first == nullptr || last == nullptr || entries == nullptr || inputs == nullptr || config == nullptr)
+        return false;
+
+    first_entry = first->GetVal();
+    last_entry = last->GetVal();
+    stopped_entry = stopped != nullptr ? stopped->GetVal() : last_entry;
+    chain_entries = entries->GetVal();
+    configuration = config->GetTitle();
+
+    input_files.clear();
+    std::istringstream files(inputs->GetTitle());
+    for (std::string name; std::getline(files, name);)
+        input_files.push_back(name);
+
+    return true;
+}
+
+bool RunInfo::SameRun(const RunInfo& other) const {
+    return chain_entries == other.chain_entries &&
+        input_files == other.input_files &&
+        configuration == other.configuration;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "TDirectory.h"
+
+#include <string>
+#include <vector>
+
+
+// Describes which part of which chain produced an output file, stored in the
+// `RunInfo` directory of every analysis output. Entries are [first, last).
+struct RunInfo
+{
+    long long first_entry;
+    long long last_entry;
+    // The entry after the last one read, before last_entry if every tool was
+    // saturated. Outputs without it were read to last_entry.
+    long long stopped_entry;
+    long long chain_entries;
+    std::vector<std::string> input_files;
+    std::string configuration;
+
+    void Write(TDirectory* file) const;
+    bool Read(TDirectory* file);
+    bool SameRun(const RunInfo& other) const;
+};
@@ -0,0 +1,51 @@
+#include "analysis/ntupler/FeatureRegistry.hpp"
+
+#include <algorithm>
+#include <sstream>
+
+
+bool FeatureSelection::Parse(const std::string& list, FeatureSelection& result) {
+    std::vector<std::string> names;
+    std::stringstream stream(list);
+    std::string name;
+
+    while (std::getline(stream, name, ',')) {
+        if (name == "scalars") {
+            for (auto& feature: ntupler_features)
+                if (!(feature.stages & FeatureStage::Image))
+                    names.push_back(feature.name);
+            continue;
+        }
+        if (FindFeature(name.c_str()) == nullptr) return false;
+        names.push_back(name);
+    }
+    if (names.empty()) return false;
+
+    // Registry order, without repetitions
+    result.names.clear();
+    for (auto& feature: ntupler_features)
+        if (std::find(names.begin(), names.end(), feature.name) != names.end())
+            result.names.push_back(feature.name);
+    return true;
+}
+
+bool FeatureSelection::Selected(const std::string& name) const {
+    return names.empty() || std::find(names.begin(), names.end(), name) != names.end();
+}
+
+unsigned FeatureSelection::Stages() const {
+    unsigned stages = FeatureStage::None;
+    for (auto& feature: ntupler_features)
+        if (Selected(feature.name))
+            stages |= feature.stages;
+    return FeatureStage::WithDependencies(stages);
+}
+
+std::string FeatureSelection::Describe() const {
+    if (names.empty()) return "features=all";
+
+    std::string description = "features=";
+    for (size_t i = 0; i < names.size(); ++i)
+        description += (i ? "," : "") + names[i];
+    return description;
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+
+// Intermediate computations of the NTupler, run per jet only if a selected
+// feature needs them.
+namespace FeatureStage
+{
+    constexpr unsigned None = 0;
+    // JetConstituents::Fill, reads the constituents and EFlow collections
+    constexpr unsigned Constituents = 1 << 0;
+    // Energy cones, track sums and angularities: the SubstructureKernels pass
+    constexpr unsigned Substructure = 1 << 1;
+    // Track pT cones over all tracks of the event
+    constexpr unsigned TrackCones = 1 << 2;
+    // Jet images of every view
+    constexpr unsigned Image = 1 << 3;
+
+    constexpr unsigned WithDependencies(unsigned stages) {
+        return stages | ((stages & (Substructure | Image)) ? Constituents : None);
+    }
+}
+
+
+struct FeatureInfo
+{
+    const char* name;
+    unsigned stages;
+    // Stored as short at reduced precision
+    bool integer;
+};
+
+// Every feature of the DS tree, in branch order. Features without stages are
+// copied from the Jet.
+constexpr FeatureInfo ntupler_features[] = {
+    {"jet_pt", FeatureStage::None, false},
+    {"jet_eta", FeatureStage::None, false},
+    {"jet_phi", FeatureStage::None, false},
+    {"delta_eta", FeatureStage::None, false},
+    {"delta_phi", FeatureStage::None, false},
+    {"n_neutral", FeatureStage::None, true},
+    {"n_charged", FeatureStage::Substructure, true},
+    {"charge", FeatureStage::None, true},
+    {"invariant_mass", FeatureStage::None, false},
+    {"btag", FeatureStage::None, true},
+    {"e_had_over_e_em", FeatureStage::None, false},
+    {"tau_0", FeatureStage::None, false},
+    {"tau_1", FeatureStage::None, false},
+    {"tau_2", FeatureStage::None, false},
+    {"abs_qj", FeatureStage::Substructure, false},
+    {"r_em", FeatureStage::Substructure, false},
+    {"r_track", FeatureStage::Substructure, false},
+    {"f_em", FeatureStage::Substructure, false},
+    // normalised to the track jet pT
+    {"p_core_1", FeatureStage::TrackCones | FeatureStage::Substructure, false},
+    {"p_core_2", FeatureStage::TrackCones | FeatureStage::Substructure, false},
+    {"f_core_1", FeatureStage::Substructure, false},
+    {"f_core_2", FeatureStage::Substructure, false},
+    {"f_core_3", FeatureStage::Substructure, false},
+    {"pt_d_square", FeatureStage::Substructure, false},
+    {"les_houches_angularity", FeatureStage::Substructure, false},
+    {"width", FeatureStage::Substructure, false},
+    {"mass", FeatureStage::Substructure, false},
+    {"track_magnitude", FeatureStage::Substructure, false},
+    // all image views
+    {"jet_image", FeatureStage::Image, false}
+};
+
+constexpr bool SameFeatureName(const char* a, const char* b) {
+    return *a == *b && (*a == '\0' || SameFeatureName(a + 1, b + 1));
+}
+
+// Registry entry of a feature, nullptr if there is none. Usable in constant expressions.
+constexpr const FeatureInfo* FindFeature(const char* name, size_t i = 0) {
+    return i == sizeof(ntupler_features) / sizeof(FeatureInfo) ? nullptr :
+        SameFeatureName(ntupler_features[i].name, name) ? &ntupler_features[i] : FindFeature(name, i + 1);
+}
+
+
+// The features written by a run, all of them by default.
+struct FeatureSelection
+{
+    // Empty for all features
+    std::vector<std::string> names;
+
+    // Comma separated feature names; "scalars" stands for every feature but the image.
+    static bool Parse(const std::string& list, FeatureSelection& result);
+    bool Selected(const std::string& name) const;
+    // Stages needed by the selected features, with their dependencies
+    unsigned Stages() const;
+    std::string Describe() const;
+};
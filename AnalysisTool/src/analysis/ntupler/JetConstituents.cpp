@@ -0,0 +1,53 @@
+#include "analysis/ntupler/JetConstituents.hpp"
+#include "analysis/io/EventView.hpp"
+#include "analysis/profiling/Profiler.hpp"
+
+#include <cmath>
+
+
+void JetConstituents::Fill(Jet* jet) {
+    PROFILE_SCOPE("JetConstituents::Fill");
+
+    for (auto column: {&tracks.pt, &tracks.eta, &tracks.phi, &tracks.charge, &tracks.px, &tracks.py, &tracks.pz,
+            &tracks.e, &tracks.delta_r})
+        column->clear();
+    for (auto column: {&towers.et, &towers.eta, &towers.phi, &towers.eem, &towers.ehad, &towers.cosh_eta,
+            &towers.delta_r})
+        column->clear();
+
+    for (long long j = 0; j < jet->Constituents.GetEntriesFast(); ++j) {
+        TObject *object = jet->Constituents.At(j);
+
+        // Check if the constituent is accessible
+        if (object == nullptr) continue;
+
+        if (object->IsA() == Track::Class()) {
+            Track* track = (Track*) object;
+
+            // As TLorentzVector::SetPtEtaPhiM
+            double px = track->PT * std::cos(track->Phi);
+            double py = track->PT * std::sin(track->Phi);
+            double pz = track->PT * std::sinh(track->Eta);
+
+            tracks.pt.push_back(track->PT);
+            tracks.eta.push_back(track->Eta);
+            tracks.phi.push_back(track->Phi);
+            tracks.charge.push_back(track->Charge);
+            tracks.px.push_back(px);
+            tracks.py.push_back(py);
+            tracks.pz.push_back(pz);
+            tracks.e.push_back(std::sqrt(px * px + py * py + pz * pz + track->Mass * track->Mass));
+            tracks.delta_r.push_back(DeltaR(jet->Eta, jet->Phi, track->Eta, track->Phi));
+        } else if (object->IsA() == Tower::Class()) {
+            Tower* tower = (Tower*) object;
+
+            towers.et.push_back(tower->ET);
+            towers.eta.push_back(tower->Eta);
+            towers.phi.push_back(tower->Phi);
+            towers.eem.push_back(tower->Eem);
+            towers.ehad.push_back(tower->Ehad);
+            towers.cosh_eta.push_back(std::cosh(tower->Eta));
+            towers.delta_r.push_back(DeltaR(jet->Eta, jet->Phi, tower->Eta, tower->Phi));
+        }
+    }
+}
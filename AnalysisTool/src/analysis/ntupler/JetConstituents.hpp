@@ -0,0 +1,49 @@
+#pragma once
+
+#include "classes/DelphesClasses.h"
+
+#include <cstddef>
+#include <vector>
+
+
+struct TrackColumns
+{
+    std::vector<double> pt;
+    std::vector<double> eta;
+    std::vector<double> phi;
+    std::vector<double> charge;
+    std::vector<double> px;
+    std::vector<double> py;
+    std::vector<double> pz;
+    std::vector<double> e;
+    // to the jet axis
+    std::vector<double> delta_r;
+
+    size_t Size() const { return pt.size(); }
+};
+
+struct TowerColumns
+{
+    std::vector<double> et;
+    std::vector<double> eta;
+    std::vector<double> phi;
+    std::vector<double> eem;
+    std::vector<double> ehad;
+    std::vector<double> cosh_eta;
+    // to the jet axis
+    std::vector<double> delta_r;
+
+    size_t Size() const { return et.size(); }
+};
+
+
+// The constituents of one jet, resolved once from the TRefs into flat
+// arrays split by type, in constituent order within each type. Buffers are
+// reused from jet to jet.
+struct JetConstituents
+{
+    TrackColumns tracks;
+    TowerColumns towers;
+
+    void Fill(Jet* jet);
+};
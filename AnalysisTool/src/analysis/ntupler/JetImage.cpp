@@ -0,0 +1,202 @@
+#include "analysis/ntupler/JetImage.hpp"
+
+#include <cctype>
+#include <cstdlib>
+#include <sstream>
+
+
+static const char* channel_names[] = {"track", "eem", "ehad"};
+
+int JetImageGeometry::Slot(int channel) const {
+    for (size_t i = 0; i < channels.size(); ++i)
+        if (channels[i] == channel) return i;
+    return -1;
+}
+
+bool JetImageGeometry::ParseChannels(const std::string& names, std::vector<int>& result) {
+    std::vector<int> parsed;
+    std::istringstream stream(names);
+
+    for (std::string name; std::getline(stream, name, ',');) {
+        int channel = -1;
+        for (int i = 0; i < 3; ++i)
+            if (name == channel_names[i]) channel = i;
+        if (channel < 0 || std::find(parsed.begin(), parsed.end(), channel) != parsed.end())
+            return false;
+        parsed.push_back(channel);
+    }
+
+    if (parsed.empty()) return false;
+    result = parsed;
+    return true;
+}
+
+std::string JetImageGeometry::ChannelNames() const {
+    std::string names;
+    for (int channel: channels)
+        names += (names.empty() ? "" : ",") + std::string(channel_names[channel]);
+    return names;
+}
+
+std::string JetImageGeometry::Describe() const {
+    std::ostringstream description;
+    description << "image_dim=" << dim << " image_r_size=" << r_size << " image_channels=" << ChannelNames();
+    return description.str();
+}
+
+bool JetImageView::Parse(const std::string& spec, JetImageView& result) {
+    std::vector<std::string> fields;
+    std::istringstream stream(spec);
+    for (std::string field; std::getline(stream, field, ':');)
+        fields.push_back(field);
+    if (fields.size() < 4) return false;
+
+    JetImageView view;
+    view.name = fields[0];
+    if (view.name.empty()) return false;
+    for (char c: view.name)
+        if (!std::isalnum((unsigned char) c) && c != '_') return false;
+
+    if (fields[1] == "axis") view.subjet_center = false;
+    else if (fields[1] == "subjet") view.subjet_center = true;
+    else return false;
+
+    int dim = std::atoi(fields[2].c_str());
+    // the sparse format indexes pixels with 16 bits
+    if (dim < 1 || dim > 128) return false;
+    view.dim = dim;
+    view.r_size = std::atof(fields[3].c_str());
+    if (!(view.r_size > 0.)) return false;
+
+    for (size_t i = 4; i < fields.size(); ++i) {
+        if (fields[i] == "rotate") view.rotate = true;
+        else if (fields[i] == "flip") view.flip = true;
+        else return false;
+    }
+
+    result = view;
+    return true;
+}
+
+std::string JetImageView::Describe() const {
+    std::ostringstream description;
+    description << "image_view=" << name << ":" << (subjet_center ? "subjet" : "axis") << ":" << dim << ":" << r_size
+        << (rotate ? ":rotate" : "") << (flip ? ":flip" : "");
+    return description.str();
+}
+
+JetImager::JetImager(const JetImageGeometry& geometry, const std::vector<JetImageView>& extra_views):
+    channels(geometry) {
+    JetImageView main_view;
+    main_view.dim = geometry.dim;
+    main_view.r_size = geometry.r_size;
+    views.push_back(main_view);
+    views.insert(views.end(), extra_views.begin(), extra_views.end());
+
+    // Views differing only in resolution share their frame
+    for (size_t i = 0; i < views.size(); ++i) {
+        size_t frame = i;
+        for (size_t k = 0; k < i; ++k) {
+            if (views[k].subjet_center == views[i].subjet_center && views[k].rotate == views[i].rotate &&
+                    views[k].flip == views[i].flip) {
+                frame = view_frame[k];
+                break;
+            }
+        }
+        view_frame.push_back(frame);
+    }
+    frames.resize(views.size());
+}
+
+void JetImager::ComputeFrame(const JetConstituents& constituents, const JetImageView& view, double center_eta,
+    double center_phi, ImageFrame& frame)
+{
+    const TrackColumns& tracks = constituents.tracks;
+    const TowerColumns& towers = constituents.towers;
+
+    frame.track_x.resize(tracks.Size());
+    frame.track_y.resize(tracks.Size());
+    for (size_t j = 0; j < tracks.Size(); ++j) {
+        frame.track_x[j] = tracks.eta[j] - center_eta;
+        frame.track_y[j] = calc_delta_phi(tracks.phi[j], center_phi);
+    }
+
+    frame.tower_x.resize(towers.Size());
+    frame.tower_y.resize(towers.Size());
+    for (size_t j = 0; j < towers.Size(); ++j) {
+        frame.tower_x[j] = towers.eta[j] - center_eta;
+        frame.tower_y[j] = calc_delta_phi(towers.phi[j], center_phi);
+    }
+
+    if (!view.rotate && !view.flip) return;
+
+    // Track pT and tower ET weighted moments
+    auto moments = [&](double& sx, double& sy, double& sxx, double& syy, double& sxy) {
+        sx = sy = sxx = syy = sxy = 0.;
+        for (size_t j = 0; j < tracks.Size(); ++j) {
+            double w = tracks.pt[j], x = frame.track_x[j], y = frame.track_y[j];
+            sx += w * x; sy += w * y; sxx += w * x * x; syy += w * y * y; sxy += w * x * y;
+        }
+        for (size_t j = 0; j < towers.Size(); ++j) {
+            double w = towers.et[j], x = frame.tower_x[j], y = frame.tower_y[j];
+            sx += w * x; sy += w * y; sxx += w * x * x; syy += w * y * y; sxy += w * x * y;
+        }
+    };
+
+    double sx, sy, sxx, syy, sxy;
+    moments(sx, sy, sxx, syy, sxy);
+
+    if (view.rotate) {
+        double angle = 0.5 * std::atan2(2. * sxy, sxx - syy);
+        double c = std::cos(angle), s = std::sin(angle);
+        auto rotate = [&](std::vector<double>& x, std::vector<double>& y) {
+            for (size_t j = 0; j < x.size(); ++j) {
+                double rx = c * x[j] + s * y[j];
+                y[j] = -s * x[j] + c * y[j];
+                x[j] = rx;
+            }
+        };
+        rotate(frame.track_x, frame.track_y);
+        rotate(frame.tower_x, frame.tower_y);
+        moments(sx, sy, sxx, syy, sxy);
+    }
+
+    if (view.flip) {
+        for (auto x: {&frame.track_x, &frame.tower_x})
+            if (sx < 0.)
+                for (auto& value: *x) value = -value;
+        for (auto y: {&frame.track_y, &frame.tower_y})
+            if (sy < 0.)
+                for (auto& value: *y) value = -value;
+    }
+}
+
+void JetImager::Fill(const JetConstituents& constituents, double axis_eta, double axis_phi, double subjet_eta,
+    double subjet_phi, std::vector<std::vector<double>>& images)
+{
+    const TowerColumns& towers = constituents.towers;
+    tower_eem.resize(towers.Size());
+    tower_ehad.resize(towers.Size());
+    for (size_t j = 0; j < towers.Size(); ++j) {
+        tower_eem[j] = towers.eem[j] / towers.cosh_eta[j];
+        tower_ehad[j] = towers.ehad[j] / towers.cosh_eta[j];
+    }
+
+    for (size_t i = 0; i < views.size(); ++i) {
+        const JetImageView& view = views[i];
+        ImageFrame& frame = frames[view_frame[i]];
+        if (view_frame[i] == i) {
+            ComputeFrame(constituents, view, view.subjet_center ? subjet_eta : axis_eta,
+                view.subjet_center ? subjet_phi : axis_phi, frame);
+        }
+
+        double* image = images[i].data();
+        switch (view.dim) {
+        case 16: BinJetImage<16>(frame, constituents, tower_eem, tower_ehad, channels, view.dim, view.r_size, image); break;
+        case 20: BinJetImage<20>(frame, constituents, tower_eem, tower_ehad, channels, view.dim, view.r_size, image); break;
+        case 32: BinJetImage<32>(frame, constituents, tower_eem, tower_ehad, channels, view.dim, view.r_size, image); break;
+        case 64: BinJetImage<64>(frame, constituents, tower_eem, tower_ehad, channels, view.dim, view.r_size, image); break;
+        default: BinJetImage<0>(frame, constituents, tower_eem, tower_ehad, channels, view.dim, view.r_size, image); break;
+        }
+    }
+}
@@ -0,0 +1,147 @@
+#pragma once
+
+#include "analysis/ntupler/JetConstituents.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#define JET_IMAGE_DIM 20
+#define JET_IMAGE_R_SIZE 0.2
+#define JET_IMAGE_DIM_TRACK 0
+#define JET_IMAGE_DIM_EEM 1
+#define JET_IMAGE_DIM_EHAD 2
+
+
+template <typename T>
+inline T calc_delta_phi(T phi1, T phi2) {
+  T result = phi1 - phi2;  // same convention as reco::deltaPhi()
+  constexpr T _twopi = M_PI*2.;
+  result /= _twopi;
+  result -= std::round(result);
+  result *= _twopi;  // result in [-pi,pi]
+  return result;
+}
+
+
+// Pixels and channels of the jet images: dim x dim pixels covering
+// +-r_size around the image centre in eta and phi, with the given channels
+// (JET_IMAGE_DIM_*) in this order.
+struct JetImageGeometry
+{
+    size_t dim = JET_IMAGE_DIM;
+    double r_size = JET_IMAGE_R_SIZE;
+    std::vector<int> channels = {JET_IMAGE_DIM_TRACK, JET_IMAGE_DIM_EEM, JET_IMAGE_DIM_EHAD};
+
+    size_t Size() const { return dim * dim * channels.size(); }
+    // Position of a channel in the image, -1 if it is not written
+    int Slot(int channel) const;
+
+    // Comma separated channel names: track, eem, ehad
+    static bool ParseChannels(const std::string& names, std::vector<int>& result);
+    std::string ChannelNames() const;
+    std::string Describe() const;
+};
+
+
+// One image of a jet: its centre (jet axis or leading trimmed subjet),
+// resolution and normalisation. The channels are shared by all views.
+struct JetImageView
+{
+    // Branch name suffix, empty for the main jet_image view
+    std::string name;
+    bool subjet_center = true;
+    size_t dim = JET_IMAGE_DIM;
+    double r_size = JET_IMAGE_R_SIZE;
+    // Rotate the energy-weighted principal axis onto eta
+    bool rotate = false;
+    // Mirror so the energy-weighted centroid has positive eta and phi
+    bool flip = false;
+
+    // name:axis|subjet:dim:r[:rotate][:flip]
+    static bool Parse(const std::string& spec, JetImageView& result);
+    std::string Describe() const;
+};
+
+
+// Constituent coordinates relative to an image centre, after the optional
+// rotation and flip.
+struct ImageFrame
+{
+    std::vector<double> track_x, track_y;
+    std::vector<double> tower_x, tower_y;
+};
+
+
+// Fills image (dim * dim * channels values, row-major [eta][phi][channel])
+// from constituent coordinates in a frame. DIM > 0 fixes the dimension at
+// compile time for the common sizes, DIM == 0 uses dim.
+template <size_t DIM>
+void BinJetImage(const ImageFrame& frame, const JetConstituents& constituents, const std::vector<double>& tower_eem,
+    const std::vector<double>& tower_ehad, const JetImageGeometry& channels, size_t dim, double range, double* image)
+{
+    if (DIM > 0) dim = DIM;
+    const size_t n_channels = channels.channels.size();
+    const int track_slot = channels.Slot(JET_IMAGE_DIM_TRACK);
+    const int eem_slot = channels.Slot(JET_IMAGE_DIM_EEM);
+    const int ehad_slot = channels.Slot(JET_IMAGE_DIM_EHAD);
+
+    std::fill(image, image + dim * dim * n_channels, 0.0);
+
+    if (eem_slot >= 0 || ehad_slot >= 0) {
+        for (size_t j = 0; j < frame.tower_x.size(); ++j) {
+            double index_eta_raw = (frame.tower_x[j] + range) / (2.0 * range);
+            if (index_eta_raw < 0.0 || index_eta_raw >= 1.0) continue;
+            double index_phi_raw = (frame.tower_y[j] + range) / (2.0 * range);
+            if (index_phi_raw < 0.0 || index_phi_raw >= 1.0) continue;
+
+            double* pixel = image + ((size_t)(index_eta_raw * dim) * dim + (size_t)(index_phi_raw * dim)) * n_channels;
+            if (eem_slot >= 0) pixel[eem_slot] += tower_eem[j];
+            if (ehad_slot >= 0) pixel[ehad_slot] += tower_ehad[j];
+        }
+    }
+
+    if (track_slot >= 0) {
+        for (size_t j = 0; j < frame.track_x.size(); ++j) {
+            double index_eta_raw = (frame.track_x[j] + range) / (2.0 * range);
+            if (index_eta_raw < 0.0 || index_eta_raw >= 1.0) continue;
+            double index_phi_raw = (frame.track_y[j] + range) / (2.0 * range);
+            if (index_phi_raw < 0.0 || index_phi_raw >= 1.0) continue;
+
+            double* pixel = image + ((size_t)(index_eta_raw * dim) * dim + (size_t)(index_phi_raw * dim)) * n_channels;
+            pixel[track_slot] += constituents.tracks.pt[j];
+        }
+    }
+}
+
+
+// Makes all image views of a jet from one pass over its constituents: the
+// transverse tower energies are computed once per jet, the relative
+// coordinates once per distinct centre/rotation/flip.
+class JetImager
+{
+  private:
+    JetImageGeometry channels;
+    std::vector<JetImageView> views;
+    std::vector<size_t> view_frame;
+    std::vector<ImageFrame> frames;
+    std::vector<double> tower_eem;
+    std::vector<double> tower_ehad;
+
+    void ComputeFrame(const JetConstituents& constituents, const JetImageView& view, double center_eta,
+        double center_phi, ImageFrame& frame);
+
+  public:
+    // The geometry gives the channels and the main view (subjet centred),
+    // extra_views are written next to it.
+    JetImager(const JetImageGeometry& geometry, const std::vector<JetImageView>& extra_views);
+
+    size_t Views() const { return views.size(); }
+    const JetImageView& View(size_t i) const { return views[i]; }
+    size_t ImageSize(size_t i) const { return views[i].dim * views[i].dim * channels.channels.size(); }
+
+    // images[i] must hold ImageSize(i) values
+    void Fill(const JetConstituents& constituents, double axis_eta, double axis_phi, double subjet_eta,
+        double subjet_phi, std::vector<std::vector<double>>& images);
+};
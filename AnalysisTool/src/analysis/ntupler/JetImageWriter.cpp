@@ -0,0 +1,138 @@
+#include "analysis/ntupler/JetImageWriter.hpp"
+
+#include <cstring>
+
+
+bool JetImageWriter::ParseFormat(const std::string& name, ImageFormat& result) {
+    if (name == "dense") result = ImageFormat::Dense;
+    else if (name == "float") result = ImageFormat::Float;
+    else if (name == "half") result = ImageFormat::Half;
+    else if (name == "sparse") result = ImageFormat::Sparse;
+    else return false;
+    return true;
+}
+
+std::string JetImageWriter::FormatName(ImageFormat format) {
+    switch (format) {
+    case ImageFormat::Dense: return "dense";
+    case ImageFormat::Float: return "float";
+    case ImageFormat::Half: return "half";
+    case ImageFormat::Sparse: return "sparse";
+    }
+    return "";
+}
+
+unsigned short JetImageWriter::FloatToHalf(float value) {
+    unsigned int bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+
+    unsigned int sign = (bits >> 16) & 0x8000;
+    unsigned int exponent = (bits >> 23) & 0xff;
+    unsigned int mantissa = bits & 0x7fffff;
+
+    // NaN and infinity
+    if (exponent == 0xff)
+        return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+
+    int half_exponent = (int) exponent - 127 + 15;
+    // Overflow to infinity
+    if (half_exponent >= 0x1f)
+        return sign | 0x7c00;
+
+    if (half_exponent <= 0) {
+        // Subnormal or zero: shift the mantissa with its implicit bit
+        if (half_exponent < -10) return sign;
+        mantissa |= 0x800000;
+        int shift = 14 - half_exponent;
+        unsigned int half_mantissa = mantissa >> shift;
+        unsigned int rest = mantissa & ((1u << shift) - 1);
+        unsigned int halfway = 1u << (shift - 1);
+        if (rest > halfway || (rest == halfway && (half_mantissa & 1)))
+            half_mantissa++;
+        return sign | half_mantissa;
+    }
+
+    unsigned int half = sign | (half_exponent << 10) | (mantissa >> 13);
+    unsigned int rest = mantissa & 0x1fff;
+    // Rounding may carry into the exponent, which is still correct
+    if (rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+        half++;
+    return half;
+}
+
+JetImageWriter::JetImageWriter(ImageFormat format, std::string prefix, size_t dim, size_t channels):
+    format(format), prefix(prefix), dim(dim), channels(channels), sparse_n(0) {}
+
+void JetImageWriter::Branch(TTree* tree, double* image) {
+    std::string dims = "[" + std::to_string(dim) + "][" + std::to_string(dim) + "][" + std::to_string(channels) + "]";
+    size_t size = dim * dim * channels;
+
+    switch (format) {
+    case ImageFormat::Dense:
+        tree->Branch(prefix.c_str(), image, ("br_" + prefix + dims + "/D").c_str());
+        break;
+    case ImageFormat::Float:
+        dense_float.resize(size);
+        tree->Branch(prefix.c_str(), dense_float.data(), (prefix + dims + "/F").c_str());
+        break;
+    case ImageFormat::Half:
+        dense_half.resize(size);
+        tree->Branch((prefix + "_f16").c_str(), dense_half.data(), (prefix + "_f16" + dims + "/s").c_str());
+        break;
+    case ImageFormat::Sparse:
+        sparse_index.resize(size);
+        sparse_value.resize(size);
+        tree->Branch((prefix + "_n").c_str(), &sparse_n, (prefix + "_n/I").c_str());
+        tree->Branch((prefix + "_index").c_str(), sparse_index.data(), (prefix + "_index[" + prefix + "_n]/s").c_str());
+        tree->Branch((prefix + "_value").c_str(), sparse_value.data(), (prefix + "_value[" + prefix + "_n]/F").c_str());
+        break;
+    }
+}
+
+void JetImageWriter::AddColumns(NpyWriter& npy, const double* image) {
+    std::vector<size_t> shape = {dim, dim, channels};
+
+    switch (format) {
+    case ImageFormat::Dense:
+        npy.AddColumn(prefix, image, shape);
+        break;
+    case ImageFormat::Float:
+        npy.AddColumn(prefix, dense_float.data(), shape);
+        break;
+    case ImageFormat::Half:
+        // numpy reads the binary16 bits directly as float16
+        npy.AddColumn(prefix + "_f16", dense_half.data(), shape, "<f2");
+        break;
+    case ImageFormat::Sparse:
+        npy.AddColumn(prefix + "_n", &sparse_n);
+        npy.AddRaggedColumn(prefix + "_index", &sparse_index, prefix + "_n");
+        npy.AddRaggedColumn(prefix + "_value", &sparse_value, prefix + "_n");
+        break;
+    }
+}
+
+void JetImageWriter::Convert(const double* image) {
+    size_t size = dim * dim * channels;
+
+    switch (format) {
+    case ImageFormat::Dense:
+        break;
+    case ImageFormat::Float:
+        for (size_t i = 0; i < size; ++i)
+            dense_float[i] = image[i];
+        break;
+    case ImageFormat::Half:
+        for (size_t i = 0; i < size; ++i)
+            dense_half[i] = FloatToHalf(image[i]);
+        break;
+    case ImageFormat::Sparse:
+        sparse_n = 0;
+        for (size_t i = 0; i < size; ++i) {
+            if (image[i] == 0.) continue;
+            sparse_index[sparse_n] = i;
+            sparse_value[sparse_n] = image[i];
+            sparse_n++;
+        }
+        break;
+    }
+}
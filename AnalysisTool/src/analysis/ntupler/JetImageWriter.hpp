@@ -0,0 +1,52 @@
+#pragma once
+
+#include "analysis/io/NpyWriter.hpp"
+
+#include "TTree.h"
+
+#include <string>
+#include <vector>
+
+
+enum class ImageFormat {
+    Dense,    // jet_image: float64[dim][dim][channels]
+    Float,    // jet_image: float32[dim][dim][channels]
+    Half,     // jet_image_f16: IEEE binary16 bits as uint16[dim][dim][channels]
+    Sparse    // jet_image_n, jet_image_index: uint16[n], jet_image_value: float32[n]
+};
+
+
+// Writes one jet image view of the NTupler in the selected storage format,
+// in branches starting with the prefix (jet_image for the main view). The
+// sparse format stores the non-zero pixels only, indexed by the flat
+// row-major position (eta_bin * dim + phi_bin) * channels + channel.
+class JetImageWriter
+{
+  private:
+    ImageFormat format;
+    std::string prefix;
+    size_t dim;
+    size_t channels;
+
+    std::vector<float> dense_float;
+    std::vector<unsigned short> dense_half;
+    int sparse_n;
+    std::vector<unsigned short> sparse_index;
+    std::vector<float> sparse_value;
+
+  public:
+    static bool ParseFormat(const std::string& name, ImageFormat& result);
+    static std::string FormatName(ImageFormat format);
+    // IEEE binary16 bits of value, rounded to nearest even
+    static unsigned short FloatToHalf(float value);
+
+    JetImageWriter(ImageFormat format, std::string prefix, size_t dim, size_t channels);
+
+    // image is the dim x dim x channels accumulation buffer of the NTupler,
+    // branched directly in the dense format.
+    void Branch(TTree* tree, double* image);
+    // The same columns for the .npy output, after Branch
+    void AddColumns(NpyWriter& npy, const double* image);
+    // Fills the output buffers from image, before TTree::Fill.
+    void Convert(const double* image);
+};
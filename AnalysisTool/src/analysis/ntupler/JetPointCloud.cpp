@@ -0,0 +1,99 @@
+#include "analysis/ntupler/JetPointCloud.hpp"
+#include "analysis/ntupler/JetImage.hpp"
+#include "analysis/profiling/Profiler.hpp"
+
+#include <algorithm>
+#include <limits>
+
+
+JetPointCloud::JetPointCloud(): tree(nullptr), cloud_n(0) {
+    // Large enough for almost every jet, so the branches rarely move
+    Reserve(128);
+}
+
+void JetPointCloud::Branch(TTree* tree) {
+    this->tree = tree;
+    tree->Branch("cloud_n", &cloud_n, "cloud_n/I");
+    tree->Branch("cloud_type", type.data(), "cloud_type[cloud_n]/b");
+    tree->Branch("cloud_delta_eta", delta_eta.data(), "cloud_delta_eta[cloud_n]/F");
+    tree->Branch("cloud_delta_phi", delta_phi.data(), "cloud_delta_phi[cloud_n]/F");
+    tree->Branch("cloud_pt_fraction", pt_fraction.data(), "cloud_pt_fraction[cloud_n]/F");
+    tree->Branch("cloud_e_fraction", e_fraction.data(), "cloud_e_fraction[cloud_n]/F");
+    tree->Branch("cloud_charge", charge.data(), "cloud_charge[cloud_n]/B");
+    tree->Branch("cloud_eem", eem.data(), "cloud_eem[cloud_n]/F");
+    tree->Branch("cloud_ehad", ehad.data(), "cloud_ehad[cloud_n]/F");
+}
+
+void JetPointCloud::AddColumns(NpyWriter& npy) {
+    npy.AddColumn("cloud_n", &cloud_n);
+    npy.AddRaggedColumn("cloud_type", &type, "cloud_n");
+    npy.AddRaggedColumn("cloud_delta_eta", &delta_eta, "cloud_n");
+    npy.AddRaggedColumn("cloud_delta_phi", &delta_phi, "cloud_n");
+    npy.AddRaggedColumn("cloud_pt_fraction", &pt_fraction, "cloud_n");
+    npy.AddRaggedColumn("cloud_e_fraction", &e_fraction, "cloud_n");
+    npy.AddRaggedColumn("cloud_charge", &charge, "cloud_n");
+    npy.AddRaggedColumn("cloud_eem", &eem, "cloud_n");
+    npy.AddRaggedColumn("cloud_ehad", &ehad, "cloud_n");
+}
+
+void JetPointCloud::SetAddresses() {
+    if (tree == nullptr) return;
+    tree->SetBranchAddress("cloud_type", type.data());
+    tree->SetBranchAddress("cloud_delta_eta", delta_eta.data());
+    tree->SetBranchAddress("cloud_delta_phi", delta_phi.data());
+    tree->SetBranchAddress("cloud_pt_fraction", pt_fraction.data());
+    tree->SetBranchAddress("cloud_e_fraction", e_fraction.data());
+    tree->SetBranchAddress("cloud_charge", charge.data());
+    tree->SetBranchAddress("cloud_eem", eem.data());
+    tree->SetBranchAddress("cloud_ehad", ehad.data());
+}
+
+void JetPointCloud::Reserve(size_t size) {
+    if (size <= type.size()) return;
+    size = std::max(size, 2 * type.size());
+
+    type.resize(size);
+    delta_eta.resize(size);
+    delta_phi.resize(size);
+    pt_fraction.resize(size);
+    e_fraction.resize(size);
+    charge.resize(size);
+    eem.resize(size);
+    ehad.resize(size);
+    SetAddresses();
+}
+
+void JetPointCloud::Fill(const JetConstituents& constituents, double jet_eta, double jet_phi, double jet_pt, double jet_e) {
+    PROFILE_SCOPE("JetPointCloud::Fill");
+
+    const TrackColumns& tracks = constituents.tracks;
+    const TowerColumns& towers = constituents.towers;
+    Reserve(tracks.Size() + towers.Size());
+
+    double inv_pt = 1. / (jet_pt + std::numeric_limits<double>::epsilon());
+    double inv_e = 1. / (jet_e + std::numeric_limits<double>::epsilon());
+
+    size_t n = 0;
+    for (size_t j = 0; j < tracks.Size(); ++j, ++n) {
+        type[n] = (unsigned char) ConstituentType::Track;
+        delta_eta[n] = tracks.eta[j] - jet_eta;
+        delta_phi[n] = calc_delta_phi(tracks.phi[j], jet_phi);
+        pt_fraction[n] = tracks.pt[j] * inv_pt;
+        e_fraction[n] = tracks.e[j] * inv_e;
+        charge[n] = tracks.charge[j];
+        eem[n] = 0.f;
+        ehad[n] = 0.f;
+    }
+    for (size_t j = 0; j < towers.Size(); ++j, ++n) {
+        type[n] = (unsigned char) ConstituentType::Tower;
+        delta_eta[n] = towers.eta[j] - jet_eta;
+        delta_phi[n] = calc_delta_phi(towers.phi[j], jet_phi);
+        pt_fraction[n] = towers.et[j] * inv_pt;
+        // Towers are massless, E = ET cosh(eta)
+        e_fraction[n] = towers.et[j] * towers.cosh_eta[j] * inv_e;
+        charge[n] = 0;
+        eem[n] = towers.eem[j];
+        ehad[n] = towers.ehad[j];
+    }
+    cloud_n = n;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "analysis/io/NpyWriter.hpp"
+#include "analysis/ntupler/JetConstituents.hpp"
+
+#include "TTree.h"
+
+#include <string>
+#include <vector>
+
+
+enum class ConstituentType : unsigned char {
+    Track = 0,
+    Tower = 1
+};
+
+
+// Writes the constituents of each NTupler jet as a particle cloud: one
+// variable length array branch per feature, all sized by cloud_n. ROOT
+// stores these as flat content plus per-entry counts, which uproot reads as
+// one contiguous array and offsets without building nested collections.
+// Tracks come first, then towers, in constituent order.
+class JetPointCloud
+{
+  private:
+    TTree* tree;
+
+    int cloud_n;
+    std::vector<unsigned char> type;
+    std::vector<float> delta_eta;
+    std::vector<float> delta_phi;
+    std::vector<float> pt_fraction;
+    std::vector<float> e_fraction;
+    std::vector<char> charge;
+    std::vector<float> eem;
+    std::vector<float> ehad;
+
+    void SetAddresses();
+
+  public:
+    JetPointCloud();
+
+    void Branch(TTree* tree);
+    void AddColumns(NpyWriter& npy);
+    // Grows the buffers, re-pointing the branches if they moved
+    void Reserve(size_t size);
+    // Relative coordinates are taken to the jet axis, fractions of the jet pT and energy.
+    void Fill(const JetConstituents& constituents, double jet_eta, double jet_phi, double jet_pt, double jet_e);
+};
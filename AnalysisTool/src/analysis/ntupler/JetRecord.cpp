@@ -0,0 +1,141 @@
+#include "analysis/ntupler/JetRecord.hpp"
+#include "analysis/ntupler/FeatureRegistry.hpp"
+#include "analysis/profiling/Profiler.hpp"
+
+#include "TLorentzVector.h"
+
+#include <cmath>
+#include <limits>
+
+
+void JetFeatures::FillImages(JetImager& imager, JetRecord& record) {
+    PROFILE_SCOPE("JetFeatures::FillImages");
+    Jet* jet = record.jet;
+
+    double center_eta, center_phi;
+    if (jet->NSubJetsTrimmed == 0) {
+        //std::cout << "There is no leading subjet" << std::endl;
+        center_eta = jet->Eta;
+        center_phi = jet->Phi;
+    } else {
+        //std::cout << "There is a leading subjet" << std::endl;
+        center_eta = jet->TrimmedP4[1].Eta();
+        center_phi = jet->TrimmedP4[1].Phi();
+    }
+
+    imager.Fill(record.constituents, jet->Eta, jet->Phi, center_eta, center_phi, record.images);
+}
+
+void JetFeatures::Substructure(JetRecord& record) {
+    PROFILE_SCOPE("JetFeatures::Substructure");
+
+    TLorentzVector jetMomentum = record.jet->P4();
+    double jet_p[3] = {jetMomentum.Px(), jetMomentum.Py(), jetMomentum.Pz()};
+
+    SubstructureKernels::Compute(record.constituents, record.jet->PT, jet_p, record.sums);
+}
+
+// Pcones: track pT in cones around the jet axis, from all tracks of the event
+void JetFeatures::TrackCones(const std::vector<double>& track_pt, const EtaPhiGrid& track_grid, JetRecord& record) {
+    PROFILE_SCOPE("JetFeatures::TrackCones");
+
+    std::array<double, JET_CONE_N>& Pcone = record.pcone;
+    track_grid.ForEachWithin(record.jet->Eta, record.jet->Phi, JET_CONE, [&](size_t j, double delta_r) {
+        Pcone[(int)floor(delta_r / JET_CONE_STEP)] += track_pt[j];
+    });
+}
+
+void JetFeatures::Finish(JetRecord& record) {
+    Jet* jet = record.jet;
+    const SubstructureSums& sums = record.sums;
+    JetScalars& out = record.scalars;
+
+    std::array<double, JET_CONE_N> Econe = sums.Econe;
+    std::array<double, JET_CONE_N> Eecone = sums.Eecone;
+    std::array<double, JET_CONE_N> Pcone = record.pcone;
+    std::array<double, JET_CONE_N> Fcore = {};
+    std::array<double, JET_CONE_N> Pcore = {};
+    TLorentzVector trackJet(sums.track_px, sums.track_py, sums.track_pz, sums.track_e);
+
+    // Cumulative summing cones
+    for (int k = 1; k < JET_CONE_N; k++)
+    {
+        Econe[k] += Econe[k - 1];
+        Eecone[k] += Eecone[k - 1];
+        Pcone[k] += Pcone[k - 1];
+    }
+
+    // jet charge, pT weighted
+    double Qjet = sums.Qjet / (sums.SumPT + std::numeric_limits<double>::epsilon());
+
+    // Average dR weighted with pT
+    double Rtrack = sums.Rtrack / (sums.SumRtPT + std::numeric_limits<double>::epsilon());
+
+    // Average dR weighted with EM energy
+    double Rem = sums.Rem / (Eecone[3] + std::numeric_limits<double>::epsilon());  //Eecone[3] energy in the cone of dR < 0.4
+    if (Rem > 1.5) Rem = 1.5;
+
+    // f_em
+    double Fem = Eecone[3] / (Econe[3] + std::numeric_limits<double>::epsilon());
+
+    // transverse pT
+    for (uint k = 0; k < Pcone.size(); k++)
+        Pcone[k] /= (trackJet.Perp() + std::numeric_limits<double>::epsilon());
+
+    // fcores and pcores
+    for (int k = 1; k < JET_CONE_N; k++)
+    {
+        Fcore[k] = Econe[k-1] / (Econe[JET_CONE_N-1] + std::numeric_limits<double>::epsilon());
+        Pcore[k] = Pcone[k-1] / (Pcone[JET_CONE_N-1] + std::numeric_limits<double>::epsilon());
+    }
+
+    out.jet_pt = jet->PT;
+    out.jet_eta = jet->Eta;
+    out.jet_phi = jet->Phi;
+
+    out.delta_eta = jet->DeltaEta; //Width of the jet in eta
+    out.delta_phi = jet->DeltaPhi; //Width of the jet in phi
+    out.n_neutral = jet->NNeutrals; //Netural particle multiplicity
+    out.n_charged = sums.nCharged; //Charged  particle multiplocity
+    out.charge = abs(jet->Charge); //Absolute value of the total charge
+    out.invariant_mass = jet->Mass; //Invariant mass of the Jet
+    out.btag = jet->BTag % 2; //btagging
+    out.track_magnitude = trackJet.Mag();
+    out.abs_qj = abs(Qjet);
+    out.r_em = Rem;
+    out.r_track = Rtrack;
+    out.f_em = Fem;
+    out.p_core_1 = Pcore[1];
+    out.p_core_2 = Pcore[2];
+    out.f_core_1 = Fcore[1];
+    out.f_core_2 = Fcore[2];
+    out.f_core_3 = Fcore[3];
+    out.pt_d_square = sums.SPT;
+    out.les_houches_angularity = sums.LHA;
+    out.width = sums.WDT;
+    out.mass = sums.MSS;
+    //extra added variables:
+    out.e_had_over_e_em = jet->EhadOverEem;
+    out.tau_0 = jet->Tau[0];
+    out.tau_1 = jet->Tau[1];
+    out.tau_2 = jet->Tau[2];
+
+    record.jet_e = jet->P4().E();
+}
+
+void JetFeatures::Compute(unsigned stages, const std::vector<double>& track_pt, const EtaPhiGrid* track_grid,
+                          JetImager& imager, JetRecord& record) {
+    if (stages & FeatureStage::Image)
+        FillImages(imager, record);
+
+    if (stages & FeatureStage::Substructure)
+        Substructure(record);
+    else
+        record.sums.Reset();
+
+    record.pcone.fill(0.0);
+    if (stages & FeatureStage::TrackCones)
+        TrackCones(track_pt, *track_grid, record);
+
+    Finish(record);
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "classes/DelphesClasses.h"
+
+#include "analysis/io/EtaPhiGrid.hpp"
+#include "analysis/ntupler/JetConstituents.hpp"
+#include "analysis/ntupler/JetImage.hpp"
+#include "analysis/ntupler/SubstructureKernels.hpp"
+
+#include <array>
+#include <vector>
+
+
+// The scalar DS features of one jet, named after their branches
+struct JetScalars
+{
+    double jet_pt = 0.;
+    double jet_eta = 0.;
+    double jet_phi = 0.;
+    double delta_eta = 0.;
+    double delta_phi = 0.;
+    double n_neutral = 0.;
+    double n_charged = 0.;
+    double charge = 0.;
+    double invariant_mass = 0.;
+    double btag = 0.;
+    double e_had_over_e_em = 0.;
+    double tau_0 = 0.;
+    double tau_1 = 0.;
+    double tau_2 = 0.;
+    double abs_qj = 0.;
+    double r_em = 0.;
+    double r_track = 0.;
+    double f_em = 0.;
+    double p_core_1 = 0.;
+    double p_core_2 = 0.;
+    double f_core_1 = 0.;
+    double f_core_2 = 0.;
+    double f_core_3 = 0.;
+    double pt_d_square = 0.;
+    double les_houches_angularity = 0.;
+    double width = 0.;
+    double mass = 0.;
+    double track_magnitude = 0.;
+};
+
+
+// A selected jet and everything computed for it. The NTupler keeps one per
+// selected jet of the event and reuses their buffers from event to event.
+struct JetRecord
+{
+    Jet* jet = nullptr;
+    JetConstituents constituents;
+    SubstructureSums sums;
+    // Track pT in cones of JET_CONE_STEP around the jet axis
+    std::array<double, JET_CONE_N> pcone;
+    // One image per view, the main view first
+    std::vector<std::vector<double>> images;
+    JetScalars scalars;
+    // for the point cloud, which is written without the Jet
+    double jet_e = 0.;
+    double tagger_score = 0.;
+};
+
+
+// The per-jet feature stages. They only read the jet, its constituents and
+// the tracks of the event and write nothing but the record (and the imager's
+// buffers), so the jets of an event can be computed concurrently, each with
+// its own imager.
+namespace JetFeatures
+{
+    // Images of every view, centred on the leading trimmed subjet
+    void FillImages(JetImager& imager, JetRecord& record);
+    // The constituent pass: energy cones, track sums and angularities
+    void Substructure(JetRecord& record);
+    // Track pT cones from all tracks of the event
+    void TrackCones(const std::vector<double>& track_pt, const EtaPhiGrid& track_grid, JetRecord& record);
+    // Normalises the sums into the scalars
+    void Finish(JetRecord& record);
+
+    // Runs the FeatureStage bits in `stages` on a record with its jet and,
+    // if needed, its constituents filled. track_grid may be null without
+    // FeatureStage::TrackCones.
+    void Compute(unsigned stages, const std::vector<double>& track_pt, const EtaPhiGrid* track_grid,
+                 JetImager& imager, JetRecord& record);
+}
@@ -1,62 +1,20 @@
 #include "analysis/ntupler/NTupler.hpp"
 #include "analysis/LinkDef.hpp"
+#include "analysis/profiling/Profiler.hpp"
+#include "TROOT.h"
 #include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <assert.h>
 
+#include <tbb/parallel_for.h>
 
 
-NTupler::NTupler(std::string sample_ident, ExRootTreeReader* reader) : consistency(reader) {
-    jets = reader->UseBranch("Jet");
-    genJets = reader->UseBranch("GenJet");
-    tracks = reader->UseBranch("EFlowTrack");
-    branchTower1 = reader->UseBranch("EFlowPhoton");
-    branchTower2 = reader->UseBranch("EFlowNeutralHadron");
-    printed = 0;
-    number_of_processed_jets = 0;
-    zero_count = 0;
-    one_count = 0;
-    two_count = 0;
-    other_count = 0;
-
-    for (size_t i = 0; i < JET_IMAGE_DIM; ++i) {
-        for (size_t j = 0; j < JET_IMAGE_DIM; ++j) {
-            br_jet_image[i][j][0] = 0.0;
-            br_jet_image[i][j][1] = 0.0;
-            br_jet_image[i][j][2] = 0.0;
-        }
-    }    
-    
-    tree = new TTree("DS", "DS tagger ML tuples");
-    tree->Branch("jet_pt", &br_jet_pt);
-    tree->Branch("jet_eta", &br_jet_eta);
-    tree->Branch("jet_phi", &br_jet_phi);
-    tree->Branch("delta_eta", &br_delta_eta);
-    tree->Branch("delta_phi", &br_delta_phi);
-    tree->Branch("n_neutral", &br_n_neutral);
-    tree->Branch("n_charged", &br_n_charged);
-    tree->Branch("charge", &br_charge);
-    tree->Branch("invariant_mass", &br_invariant_mass);
-    tree->Branch("btag", &br_btag);
-    tree->Branch("e_had_over_e_em", &br_e_had_over_e_em);
-    tree->Branch("tau_0", &br_tau_0);
-    tree->Branch("tau_1", &br_tau_1);
-    tree->Branch("tau_2", &br_tau_2);
-    tree->Branch("abs_qj", &br_abs_qj);
-    tree->Branch("r_em", &br_r_em);
-    tree->Branch("r_track", &br_r_track);
-    tree->Branch("f_em", &br_f_em);
-    tree->Branch("p_core_1", &br_p_core_1);
-    tree->Branch("p_core_2", &br_p_core_2);
-    tree->Branch("f_core_1", &br_f_core_1);
-    tree->Branch("f_core_2", &br_f_core_2);
-    tree->Branch("f_core_3", &br_f_core_3);
-    tree->Branch("pt_d_square", &br_pt_d_square);
-    tree->Branch("les_houches_angularity", &br_les_houches_angularity);
-    tree->Branch("width", &br_width);
-    tree->Branch("mass", &br_mass);
-    tree->Branch("track_magnitude", &br_track_magnitude);
-    tree->Branch("jet_image", br_jet_image, "br_jet_image[20][20][3]/D");
 
+NTupler::NTupler(std::string sample_ident, EventReader* reader, const NTuplerConfig& config):
+    reader(reader), write_point_cloud(config.point_cloud), reduced_precision(config.output.reduced_precision), fill_seconds(0.),
+    tagger_cut(config.tagger_cut), br_tagger_score(0.), tagger_score_n(nullptr), n_pending(0), imager(config.image, config.image_views) {
     if (sample_ident == "SignalWplus") {
         sample_type = SampleType::SignalWplus;
     } else if (sample_ident == "SignalWminus") {
@@ -70,6 +28,312 @@ NTupler::NTupler(std::string sample_ident, ExRootTreeReader* reader) : consisten
             " SignalWplus/SignalWminus/BackgroundGG/BackgroundQQ" << std::endl;
         assert(0);
     }
+
+    jets = reader->UseBranch("Jet");
+    genJets = nullptr;
+    if (IsSignal()) {
+        reader->UseDecayGraph();
+    } else {
+        genJets = reader->UseBranch("GenJet");
+    }
+    features = config.features;
+    stages = features.Stages();
+    if (config.point_cloud)
+        stages |= FeatureStage::Constituents;
+    // Images are written only if selected, but may be computed for the tagger
+    bool write_images = stages & FeatureStage::Image;
+
+    if (!config.tagger_file.empty()) {
+        tagger.reset(new Tagger());
+        if (!tagger->Load(config.tagger_file)) {
+            std::cerr << "Cannot load the tagger " << config.tagger_file << "." << std::endl;
+            assert(0);
+        }
+        for (auto& name: tagger->FeatureNames())
+            stages |= FindFeature(name.c_str())->stages;
+        if (tagger->HasImage())
+            stages |= FeatureStage::Image;
+        stages = FeatureStage::WithDependencies(stages);
+
+        tagger_inputs.assign(tagger->FeatureNames().size(), nullptr);
+        tagger_features.resize(tagger_inputs.size());
+        tagger_score_n = new TH1D("ntupler_tagger_score", "Tagger score of the selected jets", 100, 0., 1.);
+    }
+
+    // The constituents reference all EFlow collections, the track cones only the tracks
+    tracks = nullptr;
+    branchTower1 = nullptr;
+    branchTower2 = nullptr;
+    if (stages & (FeatureStage::Constituents | FeatureStage::TrackCones))
+        tracks = reader->UseBranch("EFlowTrack");
+    if (stages & FeatureStage::Constituents) {
+        branchTower1 = reader->UseBranch("EFlowPhoton");
+        branchTower2 = reader->UseBranch("EFlowNeutralHadron");
+    }
+    number_of_processed_jets = 0;
+    max_jets = config.max_jets;
+    worker_jets = config.worker_jets;
+    worker = config.worker;
+    unique_matching = config.unique_matching;
+    selected_jet_n = new TH1D("ntupler_selected_jet_n", "Selected jets per event (last bin: more)", 4, 0., 4.);
+
+    if (!config.npy_directory.empty() && !npy.Open(config.npy_directory))
+        std::cerr << "Cannot write to " << config.npy_directory << ", no .npy output." << std::endl;
+    npy.SetConfiguration(config.Describe());
+
+    tree = new TTree("DS", "DS tagger ML tuples");
+    AddScalar("jet_pt", &JetScalars::jet_pt);
+    AddScalar("jet_eta", &JetScalars::jet_eta);
+    AddScalar("jet_phi", &JetScalars::jet_phi);
+    AddScalar("delta_eta", &JetScalars::delta_eta);
+    AddScalar("delta_phi", &JetScalars::delta_phi);
+    AddScalar("n_neutral", &JetScalars::n_neutral);
+    AddScalar("n_charged", &JetScalars::n_charged);
+    AddScalar("charge", &JetScalars::charge);
+    AddScalar("invariant_mass", &JetScalars::invariant_mass);
+    AddScalar("btag", &JetScalars::btag);
+    AddScalar("e_had_over_e_em", &JetScalars::e_had_over_e_em);
+    AddScalar("tau_0", &JetScalars::tau_0);
+    AddScalar("tau_1", &JetScalars::tau_1);
+    AddScalar("tau_2", &JetScalars::tau_2);
+    AddScalar("abs_qj", &JetScalars::abs_qj);
+    AddScalar("r_em", &JetScalars::r_em);
+    AddScalar("r_track", &JetScalars::r_track);
+    AddScalar("f_em", &JetScalars::f_em);
+    AddScalar("p_core_1", &JetScalars::p_core_1);
+    AddScalar("p_core_2", &JetScalars::p_core_2);
+    AddScalar("f_core_1", &JetScalars::f_core_1);
+    AddScalar("f_core_2", &JetScalars::f_core_2);
+    AddScalar("f_core_3", &JetScalars::f_core_3);
+    AddScalar("pt_d_square", &JetScalars::pt_d_square);
+    AddScalar("les_houches_angularity", &JetScalars::les_houches_angularity);
+    AddScalar("width", &JetScalars::width);
+    AddScalar("mass", &JetScalars::mass);
+    AddScalar("track_magnitude", &JetScalars::track_magnitude);
+    if (tagger) {
+        assert(std::find(tagger_inputs.begin(), tagger_inputs.end(), nullptr) == tagger_inputs.end());
+        scalar_branches.push_back({"tagger_score", &br_tagger_score,
+            reduced_precision ? ScalarStorage::Float : ScalarStorage::Double, 0.f, 0});
+    }
+    BranchScalars();
+    for (size_t i = 0; i < imager.Views() && (stages & FeatureStage::Image); ++i)
+        br_jet_images.emplace_back(imager.ImageSize(i), 0.0);
+    for (size_t i = 0; i < imager.Views() && write_images; ++i) {
+        const JetImageView& view = imager.View(i);
+        image_writers.emplace_back(config.image_format, view.name.empty() ? "jet_image" : "jet_image_" + view.name,
+            view.dim, config.image.channels.size());
+    }
+    for (size_t i = 0; i < image_writers.size(); ++i) {
+        image_writers[i].Branch(tree, br_jet_images[i].data());
+        if (npy.IsOpen())
+            image_writers[i].AddColumns(npy, br_jet_images[i].data());
+    }
+    if (write_point_cloud) {
+        point_cloud.Branch(tree);
+        if (npy.IsOpen())
+            point_cloud.AddColumns(npy);
+    }
+
+    tree->SetBasketSize("*", config.output.basket_size);
+    tree->SetAutoFlush(config.output.auto_flush);
+
+    if (config.output_queue > 0)
+        output_queue.reset(new BoundedQueue<JetRecord>(config.output_queue));
+}
+
+NTupler::~NTupler() {
+    StopWriter();
+}
+
+void NTupler::AddScalar(const char* name, double JetScalars::* member) {
+    const FeatureInfo* feature = FindFeature(name);
+    assert(feature != nullptr);
+    if (tagger) {
+        const std::vector<std::string>& inputs = tagger->FeatureNames();
+        for (size_t i = 0; i < inputs.size(); ++i)
+            if (inputs[i] == name) tagger_inputs[i] = member;
+    }
+    if (!features.Selected(name)) return;
+
+    ScalarStorage storage = ScalarStorage::Double;
+    if (reduced_precision)
+        storage = feature->integer ? ScalarStorage::Short : ScalarStorage::Float;
+    scalar_branches.push_back({name, &(br.*member), storage, 0.f, 0});
+}
+
+void NTupler::BranchScalars() {
+    // The vector is complete, so the addresses of its elements are stable
+    for (auto& scalar: scalar_branches) {
+        const char* name = scalar.name.c_str();
+        switch (scalar.storage) {
+        case ScalarStorage::Double:
+            tree->Branch(name, scalar.value);
+            if (npy.IsOpen()) npy.AddColumn(name, scalar.value);
+            break;
+        case ScalarStorage::Float:
+            tree->Branch(name, &scalar.value_float);
+            if (npy.IsOpen()) npy.AddColumn(name, &scalar.value_float);
+            break;
+        case ScalarStorage::Short:
+            tree->Branch(name, &scalar.value_short);
+            if (npy.IsOpen()) npy.AddColumn(name, &scalar.value_short);
+            break;
+        }
+    }
+}
+
+void NTupler::StoreScalars() {
+    for (auto& scalar: scalar_branches) {
+        if (scalar.storage == ScalarStorage::Float)
+            scalar.value_float = *scalar.value;
+        else if (scalar.storage == ScalarStorage::Short)
+            scalar.value_short = std::lround(*scalar.value);
+    }
+}
+
+void NTupler::PendRecord(const JetRecord& record) {
+    if (n_pending == pending.size())
+        pending.emplace_back();
+
+    JetRecord& slot = pending[n_pending++];
+    slot.scalars = record.scalars;
+    slot.jet_e = record.jet_e;
+    slot.images = record.images;
+    if (write_point_cloud)
+        slot.constituents = record.constituents;
+
+    if (n_pending == TAGGER_BATCH)
+        ScorePending();
+}
+
+void NTupler::ScorePending() {
+    size_t n = n_pending;
+    if (n == 0) return;
+    n_pending = 0;
+
+    size_t n_inputs = tagger_inputs.size();
+    size_t image_size = tagger->HasImage() ? br_jet_images[0].size() : 0;
+    tagger_features.resize(n * n_inputs);
+    tagger_image.resize(n * image_size);
+    tagger_scores.resize(n);
+
+    for (size_t i = 0; i < n; ++i) {
+        for (size_t f = 0; f < n_inputs; ++f)
+            tagger_features[i * n_inputs + f] = pending[i].scalars.*tagger_inputs[f];
+        if (image_size > 0)
+            std::copy(pending[i].images[0].begin(), pending[i].images[0].end(), tagger_image.begin() + i * image_size);
+    }
+
+    tagger->Score(tagger_features.data(), tagger_image.data(), n, tagger_scores.data());
+    for (size_t i = 0; i < n; ++i) {
+        pending[i].tagger_score = tagger_scores[i];
+        tagger_score_n->Fill(pending[i].tagger_score);
+    }
+    WriteJets(pending, n);
+}
+
+void NTupler::FillOutput() {
+    PROFILE_SCOPE("NTupler::Fill");
+    auto start = std::chrono::steady_clock::now();
+    tree->Fill();
+    fill_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (npy.IsOpen())
+        npy.Append();
+}
+
+void NTupler::WriteRecord(const JetRecord& record) {
+    br = record.scalars;
+    br_tagger_score = record.tagger_score;
+    StoreScalars();
+    for (size_t v = 0; v < image_writers.size(); ++v) {
+        std::copy(record.images[v].begin(), record.images[v].end(), br_jet_images[v].begin());
+        image_writers[v].Convert(br_jet_images[v].data());
+    }
+    if (write_point_cloud)
+        point_cloud.Fill(record.constituents, record.scalars.jet_eta, record.scalars.jet_phi, record.scalars.jet_pt,
+                         record.jet_e);
+    FillOutput();
+}
+
+void NTupler::QueueRecord(const JetRecord& record) {
+    if (!writer_thread.joinable()) {
+        // The writer fills the output file while the event loop reads the input
+        ROOT::EnableThreadSafety();
+        writer_thread = std::thread(&NTupler::WriterLoop, this);
+    }
+
+    // Only what WriteRecord reads, into buffers reused from slot to slot
+    JetRecord& slot = output_queue->Acquire();
+    slot.scalars = record.scalars;
+    slot.jet_e = record.jet_e;
+    slot.tagger_score = record.tagger_score;
+    slot.images.resize(image_writers.size());
+    for (size_t v = 0; v < image_writers.size(); ++v)
+        slot.images[v] = record.images[v];
+    if (write_point_cloud)
+        slot.constituents = record.constituents;
+    output_queue->Publish();
+}
+
+void NTupler::WriterLoop() {
+    while (JetRecord* record = output_queue->Front()) {
+        WriteRecord(*record);
+        output_queue->Pop();
+    }
+}
+
+void NTupler::StopWriter() {
+    if (!writer_thread.joinable()) return;
+    output_queue->Close();
+    writer_thread.join();
+    // The main tools may read a block themselves after merging the workers
+    output_queue->Reopen();
+}
+
+std::vector<std::string> NTupler::DeferredBranches() const {
+    // The jet selection only needs the jet kinematics (and GenJets or the truth record)
+    std::vector<std::string> deferred;
+    if (stages & FeatureStage::Constituents)
+        deferred = {"Jet.Constituents", "EFlowTrack", "EFlowPhoton", "EFlowNeutralHadron"};
+    else if (stages & FeatureStage::TrackCones)
+        deferred = {"EFlowTrack"};
+    return deferred;
+}
+
+bool NTupler::IsSignal() const {
+    return sample_type == SampleType::SignalWplus || sample_type == SampleType::SignalWminus;
+}
+
+std::vector<std::string> NTupler::RequiredBranches() const {
+    std::vector<std::string> branches = {
+        "Jet.PT", "Jet.Eta", "Jet.Phi", "Jet.Mass", "Jet.DeltaEta", "Jet.DeltaPhi", "Jet.NNeutrals",
+        "Jet.Charge", "Jet.BTag", "Jet.EhadOverEem", "Jet.Tau*", "Jet.NSubJetsTrimmed", "Jet.TrimmedP4*"
+    };
+
+    // Only the collections needed by the selected features
+    if (stages & FeatureStage::Constituents) {
+        branches.insert(branches.end(), {
+            "Jet.Constituents",
+            // Constituents are TRefs, resolving them needs the unique ids and bits of the targets
+            "EFlowTrack.fUniqueID", "EFlowTrack.fBits",
+            "EFlowTrack.PT", "EFlowTrack.Eta", "EFlowTrack.Phi", "EFlowTrack.Mass", "EFlowTrack.Charge",
+            "EFlowPhoton.fUniqueID", "EFlowPhoton.fBits",
+            "EFlowPhoton.ET", "EFlowPhoton.Eta", "EFlowPhoton.Phi", "EFlowPhoton.E", "EFlowPhoton.Eem", "EFlowPhoton.Ehad",
+            "EFlowNeutralHadron.fUniqueID", "EFlowNeutralHadron.fBits",
+            "EFlowNeutralHadron.ET", "EFlowNeutralHadron.Eta", "EFlowNeutralHadron.Phi", "EFlowNeutralHadron.E",
+            "EFlowNeutralHadron.Eem", "EFlowNeutralHadron.Ehad"
+        });
+    } else if (stages & FeatureStage::TrackCones) {
+        branches.insert(branches.end(), {"EFlowTrack.PT", "EFlowTrack.Eta", "EFlowTrack.Phi", "EFlowTrack.Mass"});
+    }
+
+    if (IsSignal()) {
+        for (auto& branch: DecayGraph::RequiredBranches())
+            branches.push_back(branch);
+    } else {
+        branches.insert(branches.end(), {"Jet.Flavor", "GenJet.PT", "GenJet.Eta", "GenJet.Phi", "GenJet.Mass"});
+    }
+    return branches;
 }
 
 bool NTupler::PassCommonJetCuts(Jet* jet) {
@@ -83,23 +347,24 @@ bool NTupler::PassCommonJetCuts(Jet* jet) {
 void NTupler::GetSignalEventJets() {
     numJets = jets->GetEntriesFast();
 
-    GenParticle* ds = consistency.GetDS();
-    if (ds == nullptr) return;
+    const DecayGraph& graph = reader->GetDecayGraph();
+    long long i_ds = TruthEventConsistency::FindDS(graph);
+    if (i_ds < 0) return;
+
+    GenParticle* ds = graph.Get(i_ds);
+    const KinematicColumns& jet_columns = reader->GetEventView().jets;
 
-    double minr = 0.2;
-    long long mini = -1;
+    jet_matcher.Clear();
     for (long long i = 0; i < numJets; ++i) {
         Jet *jet = (Jet*) jets->At(i);
 
         if (!PassCommonJetCuts(jet)) continue;
 
-        double r = jet->P4().DeltaR(ds->P4());
-        if (r < minr) {
-            minr = r;
-            mini = i;
-        }
+        jet_matcher.Add(jet_columns.eta[i], jet_columns.phi[i], i);
     }
+    jet_matcher.Build();
 
+    long long mini = jet_matcher.Nearest(ds->Eta, ds->Phi, 0.2);
     if (mini == -1) return;
 
     selected_jets.push_back((Jet*) jets->At(mini));
@@ -143,290 +408,281 @@ void NTupler::GetBackgroundEventJets() {
 void NTupler::GetBackgroundEventJets() {
     numJets = jets->GetEntriesFast();
     numGenJets = genJets->GetEntriesFast();
+    const KinematicColumns& jet_columns = reader->GetEventView().jets;
+
+    jet_matcher.Clear();
+    for (long long i = 0; i < numJets; ++i) {
+        Jet *jet = (Jet*) jets->At(i);
+
+        if (!PassCommonJetCuts(jet)) continue;
+
+        if (
+            (sample_type == SampleType::BackgroundGG && jet->Flavor != 21) ||
+            (sample_type == SampleType::BackgroundQQ && (jet->Flavor <= 0 || jet->Flavor >= 6))
+        )
+            continue;
 
+        jet_matcher.Add(jet_columns.eta[i], jet_columns.phi[i], i);
+    }
+    jet_matcher.Build();
+
+    if (unique_matching) {
+        gen_jet_eta.clear();
+        gen_jet_phi.clear();
+        for (long long gj = 0; gj < numGenJets; ++gj) {
+            Jet *genJet = (Jet*) genJets->At(gj);
+            gen_jet_eta.push_back(genJet->Eta);
+            gen_jet_phi.push_back(genJet->Phi);
+        }
+
+        for (long long mini: jet_matcher.MatchOneToOne(gen_jet_eta, gen_jet_phi, 0.4))
+            if (mini >= 0)
+                selected_jets.push_back((Jet*) jets->At(mini));
+        return;
+    }
+
+    // A jet nearest to several GenJets is selected for each of them
     for (long long gj = 0; gj < numGenJets; ++gj) {
         Jet *genJet = (Jet*) genJets->At(gj);
-    
-        double minr = 0.4;
-        long long mini = -1;
-        for (long long i = 0; i < numJets; ++i) {
-            Jet *jet = (Jet*) jets->At(i);
-
-            if (!PassCommonJetCuts(jet)) continue;
-            
-            if (
-                (sample_type == SampleType::BackgroundGG && jet->Flavor != 21) ||
-                (sample_type == SampleType::BackgroundQQ && (jet->Flavor <= 0 || jet->Flavor >= 6))
-            )
-                continue;
-
-            double r = jet->P4().DeltaR(genJet->P4());
-            if (r < minr) {
-                minr = r;
-                mini = i;
-            }
-        }
 
+        long long mini = jet_matcher.Nearest(genJet->Eta, genJet->Phi, 0.4);
         if (mini >= 0) {
             selected_jets.push_back((Jet*) jets->At(mini));
         }
     }
 }
 
-void NTupler::ProcessEvent() {
-    numTracks = tracks->GetEntriesFast();
+bool NTupler::SelectEvent() {
+    PROFILE_SCOPE("NTupler::SelectEvent");
     selected_jets.clear();
 
-    if (sample_type == SampleType::SignalWplus || sample_type == SampleType::SignalWminus) {
+    if (IsSignal()) {
         GetSignalEventJets();
     } else {
         GetBackgroundEventJets();
     }
 
-    if (selected_jets.size() == 0)
-        zero_count++;
-    else if (selected_jets.size() == 1)
-        one_count++;
-    else if (selected_jets.size() == 2)
-        two_count++;
-    else
-        other_count++;
-    
-    for (size_t i = 0; i < selected_jets.size(); ++i) {
-        Jet *jet = selected_jets.at(i);
+    selected_jet_n->Fill(std::min<size_t>(selected_jets.size(), 3));
 
-        number_of_processed_jets++;
-        //reached max number of jets: 
-        if (number_of_processed_jets > MAX_PROCESSED_JETS) continue;
-
-        Qjet = 0., //jet charge pt weighted
-        nCharged = 0;
-        Rtrack = 0.; //Average dR weighted with pT
-        Rem = 0.; // Average dR weighted with EM energy
-        deltaR = 0.;
-        SumRtPT = 0.;
-        SumPT = 0.;
-        z = 0.;
-        theta = 0.;
-        SPT = 0.;
-        LHA = 0.;
-        MSS = 0.;
-        WDT = 0.;
-
-
-        make_jet_image(jet, JET_IMAGE_R_SIZE, JET_IMAGE_R_SIZE, JET_IMAGE_DIM);
-        /*printed++;
-
-        if (printed == 20) {
-            char* a = (char*) malloc(1);
-            for(size_t i =0; i < 1000; i++)
-                *(a+i) = 'b';
-        }*/
-
-        for(int j = 0; j < JET_CONE_N; ++j)
-        {
-            Eecone[j] = 0.0;
-            Econe[j] = 0.0;
-            Pcone[j] = 0.0;
-            Fcore[j] = 0.0;
-            Pcore[j] = 0.0;
-        }
-
-        TLorentzVector trackJet, jetMomentum = jet->P4();
-        TVector3 jetDir = jetMomentum.Vect();
-
-        //loop through jet constituents:
-        for (long long j = 0; j < jet->Constituents.GetEntriesFast(); ++j)
-        {
-            TObject *object = jet->Constituents.At(j);
-
-            // Check if the constituent is accessible
-            if (object == nullptr) continue;
-
-            // It is a track
-            if (object->IsA() == Track::Class()) {
-                Track* track = (Track *) object;
-
-                trackJet += track->P4();
-                deltaR = jetMomentum.DeltaR(track->P4());
-                z = track->PT / jet-> PT;
-                theta = deltaR / JET_CONE;
-
-                if (track->PT < 0.4)  continue;
-                nCharged++;
-                Qjet += track->Charge * pow(jetDir.Dot(track->P4().Vect()),0.5); //q jet pT weighted
-                Rtrack += track->PT *deltaR; //deltaR pt weighted
-
-                SumPT += pow(jetDir.Dot(track->P4().Vect()),0.5); //used for: Qjet
-                SumRtPT += track->PT; //sum of the track pt
-            }
-
-            // It is a energy deposit
-            else if (object->IsA() == Tower::Class()) {
-                Tower* tower = (Tower *) object;
-
-                deltaR = jetMomentum.DeltaR(tower->P4());
-                z = tower->ET / jet-> PT;
-                theta = deltaR / JET_CONE;
-                Rem += tower->Eem *deltaR; //deltaR EM reweighted
-
-                if (deltaR >= JET_CONE) continue;
-
-                Econe[(int)floor(deltaR / JET_CONE_STEP)] += tower->ET; //summing transverse energy in a cone of 0.1, 0.2,  0.3 and 0.4
-                Eecone[(int)floor(deltaR / JET_CONE_STEP)] += tower->Eem / TMath::CosH(tower->Eta);  //transverse em energy in cones
-            }
+    // Past the jet cap there is nothing left to compute for this event.
+    return !selected_jets.empty() && EarlierJets() + number_of_processed_jets < max_jets;
+}
 
-            // We don't care about anything else...
-            else {
-                continue;
-            }
+long long NTupler::EarlierJets() const {
+    long long jets = 0;
+    for (int w = 0; worker_jets != nullptr && w < worker; ++w)
+        jets += worker_jets[w].load(std::memory_order_relaxed);
+    return jets;
+}
 
-            LHA += z * sqrt(theta);
-            SPT += z * z; //ptd_square
-            WDT += z * theta;
-            MSS += z * theta * theta;
-        }
+bool NTupler::Saturated() const {
+    return EarlierJets() + number_of_processed_jets >= max_jets;
+}
 
-        // Pcones
-        for (long long j = 0; j < numTracks; ++j) {
-            Track *track = (Track *) tracks->At(j);
+void NTupler::ProcessEvent() {
+    PROFILE_SCOPE("NTupler::ProcessEvent");
+
+    // Without a tagger cut every computed jet is written, so the jets past
+    // max_jets are not computed at all
+    size_t n_jets = selected_jets.size();
+    if (!tagger)
+        n_jets = std::min<long long>(n_jets, std::max(0LL, max_jets - EarlierJets() - number_of_processed_jets));
+
+    while (records.size() < n_jets) {
+        records.emplace_back();
+        records.back().images = br_jet_images;
+        imagers.push_back(imager);
+    }
 
-            deltaR = jetMomentum.DeltaR(track->P4());
-            if (deltaR >= JET_CONE) continue;
-            Pcone[(int)floor(deltaR / JET_CONE_STEP)] += track->PT;
-        }
+    // Resolving the constituent TRefs goes through ROOT's process tables, so
+    // it stays serial
+    for (size_t i = 0; i < n_jets; ++i) {
+        records[i].jet = selected_jets[i];
+        if (stages & FeatureStage::Constituents)
+            records[i].constituents.Fill(selected_jets[i]);
+    }
 
-        // Cumulative summing cones
-        for (int k = 1; k < JET_CONE_N; k++) 
-        {
-            Econe[k] += Econe[k - 1];
-            Eecone[k] += Eecone[k - 1];
-            Pcone[k] += Pcone[k - 1];
-        }
+    const std::vector<double>& track_pt = reader->GetEventView().tracks.pt;
+    const EtaPhiGrid* track_grid = (stages & FeatureStage::TrackCones) ? &reader->GetTrackGrid() : nullptr;
+    auto compute = [&](size_t i) {
+        JetFeatures::Compute(stages, track_pt, track_grid, imagers[i], records[i]);
+    };
+    // The jets are independent; with one jet the task overhead is not worth it
+    if (n_jets > 1)
+        tbb::parallel_for(size_t(0), n_jets, compute);
+    else if (n_jets == 1)
+        compute(0);
+
+    // The tagger scores the jets of several events at once, the jets are
+    // written in the same order either way
+    if (tagger) {
+        for (size_t i = 0; i < n_jets; ++i)
+            PendRecord(records[i]);
+    } else {
+        WriteJets(records, n_jets);
+    }
+}
 
-        // jet charge, pT weighted
-        Qjet /= (SumPT + std::numeric_limits<double>::epsilon());
+void NTupler::WriteJets(const std::vector<JetRecord>& jets, size_t n) {
+    long long earlier_jets = EarlierJets();
+    for (size_t i = 0; i < n; ++i) {
+        const JetRecord& record = jets[i];
 
-        // Average dR weighted with pT
-        Rtrack /= (SumRtPT + std::numeric_limits<double>::epsilon());
+        //reached max number of jets: 
+        if (earlier_jets + number_of_processed_jets >= max_jets) break;
+        // Jets below the tagger cut are not written and do not count towards max_jets
+        if (tagger && record.tagger_score < tagger_cut) continue;
+        number_of_processed_jets++;
 
-        // Average dR weighted with EM energy
-        Rem /= (Eecone[3] + std::numeric_limits<double>::epsilon());  //Eecone[3] energy in the cone of dR < 0.4
-        if (Rem > 1.5) Rem = 1.5;
+        if (output_queue)
+            QueueRecord(record);
+        else
+            WriteRecord(record);
+    }
+    if (worker_jets != nullptr)
+        worker_jets[worker].store(number_of_processed_jets, std::memory_order_relaxed);
+}
 
-        // f_em
-        double Fem = Eecone[3] / (Econe[3] + std::numeric_limits<double>::epsilon());
+void NTupler::Merge(TDirectory* partial) {
+    Flush();
 
-        // transverse pT
-        for (uint k = 0; k < Pcone.size(); k++)
-            Pcone[k] /= (trackJet.Perp() + std::numeric_limits<double>::epsilon());
+    TH1* partial_selected_jet_n = partial->Get<TH1>(selected_jet_n->GetName());
+    if (partial_selected_jet_n != nullptr)
+        selected_jet_n->Add(partial_selected_jet_n);
+    if (tagger_score_n != nullptr) {
+        TH1* partial_tagger_score_n = partial->Get<TH1>(tagger_score_n->GetName());
+        if (partial_tagger_score_n != nullptr)
+            tagger_score_n->Add(partial_tagger_score_n);
+    }
 
-        // fcores and pcores
-        for (int k = 1; k < JET_CONE_N; k++)
-        {
-            Fcore[k] = Econe[k-1] / (Econe[JET_CONE_N-1] + std::numeric_limits<double>::epsilon());
-            Pcore[k] = Pcone[k-1] / (Pcone[JET_CONE_N-1] + std::numeric_limits<double>::epsilon());
+    TTree* partial_tree = partial->Get<TTree>(tree->GetName());
+    if (partial_tree == nullptr) return;
+
+    // Partial trees arrive in entry order, so capping here keeps the same
+    // jets as a single pass over the chain would.
+    long long remaining = std::max(0LL, max_jets - tree->GetEntries());
+    long long copied = std::min(remaining, partial_tree->GetEntries());
+    if (npy.IsOpen()) {
+        // Read the partial entries into the output buffers, so both outputs get them
+        if (write_point_cloud)
+            point_cloud.Reserve(partial_tree->GetMaximum("cloud_n"));
+        tree->CopyAddresses(partial_tree);
+        for (long long entry = 0; entry < copied; ++entry) {
+            partial_tree->GetEntry(entry);
+            FillOutput();
         }
-
-        //filling branches:
-        br_jet_pt = jet->PT;
-        br_jet_eta = jet->Eta;
-        br_jet_phi = jet->Phi;
-
-        br_delta_eta = jet->DeltaEta; //Width of the jet in eta
-        br_delta_phi = jet->DeltaPhi; //Width of the jet in phi
-        br_n_neutral = jet->NNeutrals; //Netural particle multiplicity
-        br_n_charged = nCharged; //Charged  particle multiplocity
-        br_charge = abs(jet->Charge); //Absolute value of the total charge
-        br_invariant_mass = jet->Mass; //Invariant mass of the Jet
-        br_btag = jet->BTag % 2; //btagging
-        br_track_magnitude = trackJet.Mag();
-        br_abs_qj = abs(Qjet);
-        br_r_em = Rem;
-        br_r_track = Rtrack;
-        br_f_em = Fem;
-        br_p_core_1 = Pcore[1];
-        br_p_core_2 = Pcore[2];
-        br_f_core_1 = Fcore[1];
-        br_f_core_2 = Fcore[2];
-        br_f_core_3 = Fcore[3];
-        br_pt_d_square = SPT;
-        br_les_houches_angularity = LHA;
-        br_width = WDT;
-        br_mass = MSS;
-        //extra added variables:
-        br_e_had_over_e_em = jet->EhadOverEem;
-        br_tau_0 = jet->Tau[0];
-        br_tau_1 = jet->Tau[1];
-        br_tau_2 = jet->Tau[2];
-
-        tree->Fill();
+        tree->CopyAddresses(partial_tree, true);
+    } else if (copied > 0) {
+        tree->CopyEntries(partial_tree, copied);
     }
+    number_of_processed_jets += copied;
+}
 
+bool NTupler::SaturatedAfterMerge(TDirectory* partial) const {
+    TTree* partial_tree = partial->Get<TTree>(tree->GetName());
+    long long partial_jets = partial_tree != nullptr ? partial_tree->GetEntries() : 0;
+    return number_of_processed_jets + partial_jets >= max_jets;
+}
+
+void NTupler::Flush() {
+    if (tagger)
+        ScorePending();
+    StopWriter();
 }
 
 void NTupler::Finalize() {
+    long long zero_count = selected_jet_n->GetBinContent(1);
+    long long one_count = selected_jet_n->GetBinContent(2);
+    long long two_count = selected_jet_n->GetBinContent(3);
+    long long other_count = selected_jet_n->GetBinContent(4);
+
     std::cerr << "Events with 0 selected jets: " << zero_count << std::endl;
     std::cerr << "Events with 1 selected jets: " << one_count << std::endl;
     std::cerr << "Events with 2 selected jets: " << two_count << std::endl;
     std::cerr << "Events with more selected jets: " << other_count << std::endl;
     std::cerr << "Total tuples: " << one_count + 2 * two_count << std::endl;
-}
 
-void NTupler::make_jet_image(Jet *jet, double relative_eta_range, double relative_phi_range, size_t dim)
-{
-    for(size_t x = 0; x < dim; ++x)
-        for(size_t y = 0; y < dim; ++y)
-            for(size_t z = 0; z < 3; ++z)
-                br_jet_image[x][y][z] = 0.0;
-
-    double center_eta, center_phi;
-    if (jet->NSubJetsTrimmed == 0) {
-        //std::cout << "There is no leading subjet" << std::endl;
-        center_eta = jet->Eta;
-        center_phi = jet->Phi;
-    } else {
-        //std::cout << "There is a leading subjet" << std::endl;
-        center_eta = jet->TrimmedP4[1].Eta();
-        center_phi = jet->TrimmedP4[1].Phi();
+    Flush();
+    if (output_queue && output_queue->Pushes() > 0)
+        std::cerr << "Output queue: " << output_queue->Pushes() << " jets through " << output_queue->Capacity()
+            << " slots, mean depth " << output_queue->MeanDepth() << ", max depth " << output_queue->MaxDepth()
+            << "; the event loop waited " << output_queue->WaitSeconds() << " s for the writer." << std::endl;
+
+    if (tagger_score_n != nullptr)
+        std::cerr << "Tagger scored " << (long long) tagger_score_n->GetEntries() << " jets, "
+            << tree->GetEntries() << " written with a score of at least " << tagger_cut << "." << std::endl;
+
+    auto start = std::chrono::steady_clock::now();
+    tree->FlushBaskets();
+    fill_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    double total_bytes = tree->GetTotBytes();
+    double zip_bytes = tree->GetZipBytes();
+    std::cerr << "DS tree: " << tree->GetEntries() << " entries, " << zip_bytes / 1e6 << " MB written from "
+        << total_bytes / 1e6 << " MB (ratio " << total_bytes / std::max(zip_bytes, 1.) << "), "
+        << fill_seconds << " s filling and compressing." << std::endl;
+
+    if (npy.IsOpen()) {
+        long long rows = npy.Rows();
+        if (npy.Close())
+            std::cerr << "Wrote " << rows << " rows of .npy columns." << std::endl;
+        else
+            std::cerr << "Error writing the .npy columns." << std::endl;
     }
 
-    for (long long j = 0; j < jet->Constituents.GetEntriesFast(); ++j) {
-        TObject *object = jet->Constituents.At(j);
-
-        // Check if the constituent is accessible
-        if (object == nullptr) continue;
-        if (object->IsA() == Tower::Class()) {
-            Tower *cell = (Tower*) object;
-
-            double delta_eta = cell->Eta - center_eta;
-            double delta_phi = calc_delta_phi((double) cell->Phi, center_phi);
+    if (SubstructureKernels::mode == KernelMode::Validate) {
+        if (!SubstructureKernels::HasAVX2())
+            std::cerr << "Kernel validation skipped, the CPU has no AVX2." << std::endl;
+        else
+            std::cerr << "Kernel validation: " << SubstructureKernels::mismatches << " of "
+                << SubstructureKernels::validated << " jets differ between the scalar and AVX2 kernels." << std::endl;
+    }
+}
 
-            double index_eta_raw = (delta_eta + relative_eta_range) / (2.0 * relative_eta_range);
-            if (index_eta_raw < 0.0 || index_eta_raw >= 1.0) continue;
-            double index_phi_raw = (delta_phi + relative_phi_range) / (2.0 * relative_phi_range);
-            if (index_phi_raw < 0.0 || index_phi_raw >= 1.0) continue;
+std::string NTuplerConfig::Describe() const {
+    std::string description = features.Describe() + " " + image.Describe() + " image_format=" + JetImageWriter::FormatName(image_format);
+    for (auto& view: image_views)
+        description += " " + view.Describe();
+    if (point_cloud)
+        description += " point_cloud=1";
+    description += " " + output.Describe();
+    description += " max_jets=" + std::to_string(max_jets);
+    description += std::string(" jet_matching=") + (unique_matching ? "unique" : "nearest");
+    if (!tagger_file.empty())
+        description += " tagger=" + tagger_file + " tagger_cut=" + std::to_string(tagger_cut);
+    return description;
+}
 
-            //std::cout << "tower eta: " << cell->Eta << " delta_eta: " << delta_eta << " phi: " << cell->Phi << " delta_phi: " << delta_phi << std::endl;
-            //std::cout << "      pix: " << (index_eta_raw*dim) << "       piy: " << (index_phi_raw*dim) << " Ev: " << cell->E / std::cosh(cell->Eta) << std::endl << std::endl;
+bool NTuplerConfig::CheckTagger() const {
+    Tagger tagger;
+    if (!tagger.Load(tagger_file)) return false;
 
-            br_jet_image[(size_t)(index_eta_raw * dim)][(size_t)(index_phi_raw * dim)][JET_IMAGE_DIM_EEM] += cell->Eem / std::cosh(cell->Eta);
-            br_jet_image[(size_t)(index_eta_raw * dim)][(size_t)(index_phi_raw * dim)][JET_IMAGE_DIM_EHAD] += cell->Ehad / std::cosh(cell->Eta);
+    for (auto& name: tagger.FeatureNames()) {
+        const FeatureInfo* feature = FindFeature(name.c_str());
+        if (feature == nullptr || feature->stages == FeatureStage::Image) {
+            std::cout << "The tagger input '" << name << "' is not a scalar ntupler feature." << std::endl;
+            return false;
         }
+    }
+    if (tagger.HasImage() && (tagger.ImageDim() != image.dim || tagger.ImageChannels() != image.channels.size())) {
+        std::cout << "The tagger expects " << tagger.ImageDim() << " x " << tagger.ImageDim() << " jet images with "
+            << tagger.ImageChannels() << " channels, the ntupler makes " << image.dim << " x " << image.dim
+            << " with " << image.channels.size() << "." << std::endl;
+        return false;
+    }
 
-        if (object->IsA() == Track::Class()) {
-            Track *track = (Track*) object;
-
-            double delta_eta = track->Eta - center_eta;
-            double delta_phi = calc_delta_phi((double) track->Phi, center_phi);
-
-            double index_eta_raw = (delta_eta + relative_eta_range) / (2.0 * relative_eta_range);
-            if (index_eta_raw < 0.0 || index_eta_raw >= 1.0) continue;
-            double index_phi_raw = (delta_phi + relative_phi_range) / (2.0 * relative_phi_range);
-            if (index_phi_raw < 0.0 || index_phi_raw >= 1.0) continue;
-
-            br_jet_image[(size_t)(index_eta_raw * dim)][(size_t)(index_phi_raw * dim)][JET_IMAGE_DIM_TRACK] += track->PT;
-            
-        }
+    double low = -std::numeric_limits<double>::infinity();
+    double high = std::numeric_limits<double>::infinity();
+    if (tagger.ScoreActivation() == Activation::Sigmoid || tagger.ScoreActivation() == Activation::ReLU)
+        low = 0.;
+    if (tagger.ScoreActivation() == Activation::Tanh)
+        low = -1.;
+    if (tagger.ScoreActivation() == Activation::Sigmoid || tagger.ScoreActivation() == Activation::Tanh)
+        high = 1.;
+    if (std::isfinite(tagger_cut) && (tagger_cut < low || tagger_cut > high)) {
+        std::cout << "The tagger cut " << tagger_cut << " lies outside the tagger's score range [" << low << ", "
+            << high << "]." << std::endl;
+        return false;
     }
+    return true;
 }
@@ -1,31 +1,57 @@
 #pragma once
 
+#include <atomic>
 #include <vector>
+#include <memory>
 #include <cmath>
 #include <iostream>
+#include <limits>
+#include <thread>
 #include "TClonesArray.h"
 #include "classes/DelphesClasses.h"
-#include "external/ExRootAnalysis/ExRootTreeReader.h"
 
 #include "analysis/AnalysisTool.hpp"
+#include "analysis/io/BoundedQueue.hpp"
+#include "analysis/io/DeltaRMatcher.hpp"
+#include "analysis/io/EventReader.hpp"
+#include "analysis/io/OutputProfile.hpp"
+#include "analysis/ntupler/FeatureRegistry.hpp"
+#include "analysis/ntupler/JetConstituents.hpp"
+#include "analysis/ntupler/JetImage.hpp"
+#include "analysis/ntupler/JetImageWriter.hpp"
+#include "analysis/ntupler/JetPointCloud.hpp"
+#include "analysis/ntupler/JetRecord.hpp"
+#include "analysis/ntupler/SubstructureKernels.hpp"
+#include "analysis/ntupler/Tagger.hpp"
 #include "analysis/truth/EventConsistency.hpp"
 
 #include "TLorentzVector.h"
 #include "TFile.h"
 #include "TTree.h"
+#include "TH1.h"
 
-#define MAX_JETS 20
 #define MAX_PROCESSED_JETS 80000
-#define JET_CONE 0.4
-#define JET_CONE_STEP 0.1
-#define JET_CONE_N 4 // 0.4/0.1
+// Jets scored by the tagger at once, collected across events
+#define TAGGER_BATCH 64
+
+
+enum class ScalarStorage {
+    Double,
+    Float,
+    Short
+};
+
+// A selected feature of the NTupler and the copy stored in the DS tree, if
+// the output profile stores it at reduced precision
+struct ScalarBranch
+{
+    std::string name;
+    double* value;
+    ScalarStorage storage;
+    float value_float;
+    short value_short;
+};
 
-#define JET_IMAGE_DIM 20
-#define JET_IMAGE_SIZE 400
-#define JET_IMAGE_R_SIZE 0.2
-#define JET_IMAGE_DIM_TRACK 0
-#define JET_IMAGE_DIM_EEM 1
-#define JET_IMAGE_DIM_EHAD 2
 
 enum class SampleType {
     SignalWplus,
@@ -34,110 +60,160 @@ enum class SampleType {
     BackgroundQQ
 };
 
+// Run options of the ntupler
+struct NTuplerConfig
+{
+    FeatureSelection features;
+    JetImageGeometry image;
+    // Written as jet_image_<name> next to the main jet_image
+    std::vector<JetImageView> image_views;
+    ImageFormat image_format = ImageFormat::Dense;
+    // Also write the constituents of each jet as cloud_* arrays
+    bool point_cloud = false;
+    // Also write every DS branch as <name>.npy in this directory
+    std::string npy_directory;
+    OutputProfile output;
+    // Jets written before the ntupler is saturated
+    long long max_jets = MAX_PROCESSED_JETS;
+    // Background GenJets select one jet each, or the best one-to-one assignment
+    bool unique_matching = false;
+    // Jets buffered for a writer thread filling the DS tree, 0 to fill it on
+    // the event loop thread
+    size_t output_queue = 0;
+    // Weights file of a tagger scoring every jet (ml_tool export), none if empty
+    std::string tagger_file;
+    // Jets scoring below the cut are not written
+    double tagger_cut = -std::numeric_limits<double>::infinity();
+    // Jets written so far by every worker of a --threads or --procs run, in
+    // block order, and the index of this worker. The jets of earlier blocks
+    // come first in the merged output, so they count towards max_jets.
+    std::atomic<long long>* worker_jets = nullptr;
+    int worker = 0;
+
+    // Prints the problem and returns false if the tagger cannot run on these jets
+    bool CheckTagger() const;
+    // Recorded in the RunInfo configuration of the output
+    std::string Describe() const;
+};
+
 
 class NTupler: AnalysisTool
 {
   private:
-    TruthEventConsistency consistency;
+    friend class NTuplerBenchmark;
+
+    // Jet and track kinematics come from the reader's EventView. Only
+    // signal samples use the truth record, to find the Ds.
+    EventReader* reader;
 
     long long numJets;
     TClonesArray *jets;
     long long numGenJets;
     TClonesArray *genJets;
 
-    long long numTracks;
     TClonesArray *tracks;
 
     TClonesArray *branchTower1;
     TClonesArray *branchTower2;
 
-    TFile* file;
     TTree* tree;
+    std::vector<JetImageWriter> image_writers;
+    bool write_point_cloud;
+    JetPointCloud point_cloud;
+    NpyWriter npy;
+    std::vector<ScalarBranch> scalar_branches;
+    bool reduced_precision;
+    FeatureSelection features;
+    // FeatureStage bits run for every jet
+    unsigned stages;
+    // Time in TTree::Fill and the final flush, serialising and compressing baskets
+    double fill_seconds;
+
+    // Declares a feature of the registry, written if it is selected
+    void AddScalar(const char* name, double JetScalars::* member);
+    // Branches the DS tree and the .npy output alike
+    void BranchScalars();
+    void StoreScalars();
+    void FillOutput();
+    // Fills the outputs with one jet, on the writer thread if there is one
+    void WriteRecord(const JetRecord& record);
+
+    // Jets on their way to the writer thread, see NTuplerConfig::output_queue
+    std::unique_ptr<BoundedQueue<JetRecord>> output_queue;
+    std::thread writer_thread;
+    void QueueRecord(const JetRecord& record);
+    void WriterLoop();
+    // Writes the queued jets and joins the writer thread
+    void StopWriter();
+
+    // Scores every selected jet, see NTuplerConfig::tagger_file. Its inputs
+    // are computed even if they are not written.
+    std::unique_ptr<Tagger> tagger;
+    std::vector<double JetScalars::*> tagger_inputs;
+    std::vector<float> tagger_features;
+    std::vector<float> tagger_image;
+    std::vector<float> tagger_scores;
+    double tagger_cut;
+    double br_tagger_score;
+    TH1D* tagger_score_n;
+    // Jets waiting for the tagger, written once TAGGER_BATCH of them are
+    // scored. Only what WriteRecord reads is kept.
+    std::vector<JetRecord> pending;
+    size_t n_pending;
+    void PendRecord(const JetRecord& record);
+    // Scores the pending jets in one batch and writes them
+    void ScorePending();
 
     std::vector<Jet*> selected_jets;
     SampleType sample_type;
 
-    size_t printed;
-    int number_of_processed_jets;
+    // Jets passing the selection cuts of the sample, matched to the Ds or GenJets
+    DeltaRMatcher jet_matcher;
+    bool unique_matching;
+    std::vector<double> gen_jet_eta;
+    std::vector<double> gen_jet_phi;
+
+    long long number_of_processed_jets;
+    long long max_jets;
+    // See NTuplerConfig::worker_jets
+    std::atomic<long long>* worker_jets;
+    int worker;
+    // Jets written by the workers of the earlier blocks so far, a lower bound
+    // of what they write in the end
+    long long EarlierJets() const;
+    // Writes the first n jets passing the tagger cut up to max_jets
+    void WriteJets(const std::vector<JetRecord>& jets, size_t n);
 
     void GetBackgroundEventJets();
     void GetSignalEventJets();
     bool PassCommonJetCuts(Jet* jet);
+    bool IsSignal() const;
 
-    long long zero_count;
-    long long one_count;
-    long long two_count;
-    long long other_count;
+    TH1D* selected_jet_n;
     
-    double br_jet_pt;
-    double br_jet_eta;
-    double br_jet_phi;
-    double br_delta_eta;
-    double br_delta_phi;
-    double br_n_neutral;
-    double br_n_charged;
-    double br_charge;
-    double br_invariant_mass;
-    double br_btag;
-    double br_e_had_over_e_em;
-    double br_tau_0;
-    double br_tau_1;
-    double br_tau_2;
-    double br_abs_qj;
-    double br_r_em;
-    double br_r_track;
-    double br_f_em;
-    double br_p_core_1;
-    double br_p_core_2;
-    double br_f_core_1;
-    double br_f_core_2;
-    double br_f_core_3;
-    double br_pt_d_square;
-    double br_les_houches_angularity;
-    double br_width;
-    double br_mass;
-    double br_track_magnitude;
-    double br_jet_image[20][20][3];
-
-    //variables needed for calculation:
-    double Qjet; //jet charge pt weighted
-    double nCharged;
-    double Rtrack; //Average dR weighted with pT
-    double Rem; // Average dR weighted with EM energy
-    double deltaR;
-    double SumRtPT;
-    double SumPT;
-
-    double z;
-    double theta;
-    double SPT;
-    double LHA;
-    double MSS;
-    double WDT;
-
-    std::array<double, JET_CONE_N> Econe;
-    std::array<double, JET_CONE_N> Eecone;
-    std::array<double, JET_CONE_N> Pcone;
-
-    std::array<double, JET_CONE_N> Fcore;
-    std::array<double, JET_CONE_N> Pcore;
-
+    // The jets of an event are computed concurrently into records, then
+    // written in order through the branch buffers below
+    std::vector<JetRecord> records;
+    // One per record, the imager keeps per-jet buffers
+    std::vector<JetImager> imagers;
+    // The configured imager, only the prototype the `imagers` are copied from;
+    // it never fills an image itself
+    JetImager imager;
+
+    JetScalars br;
+    // One image per view, the main view first
+    std::vector<std::vector<double>> br_jet_images;
 
   public:
-    NTupler(std::string sample_ident, ExRootTreeReader*);
+    NTupler(std::string sample_ident, EventReader*, const NTuplerConfig& config = NTuplerConfig());
+    virtual ~NTupler();
+    virtual bool SelectEvent();
+    virtual bool Saturated() const;
     virtual void ProcessEvent();
+    virtual std::vector<std::string> RequiredBranches() const;
+    virtual std::vector<std::string> DeferredBranches() const;
+    virtual void Merge(TDirectory* partial);
+    virtual bool SaturatedAfterMerge(TDirectory* partial) const;
+    virtual void Flush();
     virtual void Finalize();
-    void make_jet_image(Jet *jet, double relative_eta_range, double relative_phi_range, size_t dim);
 };
-
-
-template <typename T>
-inline T calc_delta_phi(T phi1, T phi2) {
-  T result = phi1 - phi2;  // same convention as reco::deltaPhi()
-  constexpr T _twopi = M_PI*2.;
-  result /= _twopi;
-  result -= std::round(result);
-  result *= _twopi;  // result in [-pi,pi]
-  return result;
-}
-
@@ -0,0 +1,91 @@
+#include "analysis/ntupler/SubstructureKernels.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+
+KernelMode SubstructureKernels::mode = KernelMode::Auto;
+std::atomic<long long> SubstructureKernels::validated(0);
+std::atomic<long long> SubstructureKernels::mismatches(0);
+
+// Sums are reordered by the vector kernel, anything beyond rounding is a bug
+#define KERNEL_VALIDATION_TOLERANCE 1e-9
+
+
+void SubstructureSums::Reset() {
+    Econe.fill(0.);
+    Eecone.fill(0.);
+    Qjet = nCharged = Rtrack = Rem = SumRtPT = SumPT = SPT = LHA = MSS = WDT = 0.;
+    track_px = track_py = track_pz = track_e = 0.;
+}
+
+double SubstructureSums::MaxRelativeDifference(const SubstructureSums& other) const {
+    std::vector<std::pair<double, double>> values = {
+        {Qjet, other.Qjet}, {nCharged, other.nCharged}, {Rtrack, other.Rtrack}, {Rem, other.Rem},
+        {SumRtPT, other.SumRtPT}, {SumPT, other.SumPT}, {SPT, other.SPT}, {LHA, other.LHA}, {MSS, other.MSS},
+        {WDT, other.WDT}, {track_px, other.track_px}, {track_py, other.track_py}, {track_pz, other.track_pz},
+        {track_e, other.track_e}
+    };
+    for (int k = 0; k < JET_CONE_N; ++k) {
+        values.emplace_back(Econe[k], other.Econe[k]);
+        values.emplace_back(Eecone[k], other.Eecone[k]);
+    }
+
+    double result = 0.;
+    for (auto& value: values) {
+        // NaN from negative projections compares equal to NaN
+        if (std::isnan(value.first) && std::isnan(value.second)) continue;
+
+        double scale = std::max({std::abs(value.first), std::abs(value.second), 1e-12});
+        double difference = std::abs(value.first - value.second) / scale;
+        result = std::isnan(difference) ? HUGE_VAL : std::max(result, difference);
+    }
+    return result;
+}
+
+bool SubstructureKernels::ParseMode(const std::string& name, KernelMode& result) {
+    if (name == "auto") result = KernelMode::Auto;
+    else if (name == "scalar") result = KernelMode::Scalar;
+    else if (name == "avx2") result = KernelMode::AVX2;
+    else if (name == "validate") result = KernelMode::Validate;
+    else return false;
+    return true;
+}
+
+void SubstructureKernels::Scalar(const JetConstituents& constituents, double jet_pt, const double jet_p[3], SubstructureSums& sums) {
+    sums.Reset();
+
+    for (size_t j = 0; j < constituents.tracks.Size(); ++j)
+        AddTrack(constituents.tracks, j, jet_pt, jet_p, sums);
+    for (size_t j = 0; j < constituents.towers.Size(); ++j)
+        AddTower(constituents.towers, j, jet_pt, sums);
+}
+
+void SubstructureKernels::Compute(const JetConstituents& constituents, double jet_pt, const double jet_p[3], SubstructureSums& sums) {
+    static const bool avx2 = HasAVX2();
+
+    switch (mode) {
+    case KernelMode::Scalar:
+        Scalar(constituents, jet_pt, jet_p, sums);
+        break;
+    case KernelMode::Auto:
+    case KernelMode::AVX2:
+        if (avx2)
+            AVX2(constituents, jet_pt, jet_p, sums);
+        else
+            Scalar(constituents, jet_pt, jet_p, sums);
+        break;
+    case KernelMode::Validate: {
+        Scalar(constituents, jet_pt, jet_p, sums);
+        if (!avx2) break;
+
+        SubstructureSums vector_sums;
+        AVX2(constituents, jet_pt, jet_p, vector_sums);
+        validated++;
+        if (sums.MaxRelativeDifference(vector_sums) > KERNEL_VALIDATION_TOLERANCE)
+            mismatches++;
+        break;
+    }
+    }
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include "analysis/ntupler/JetConstituents.hpp"
+
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <string>
+
+#define JET_CONE 0.4
+#define JET_CONE_STEP 0.1
+#define JET_CONE_N 4 // 0.4/0.1
+#define TRACK_MIN_PT 0.4
+
+
+// Constituent sums of one jet, before the normalisations done in
+// NTupler::ProcessEvent.
+struct SubstructureSums
+{
+    std::array<double, JET_CONE_N> Econe;
+    std::array<double, JET_CONE_N> Eecone;
+    double Qjet;
+    double nCharged;
+    double Rtrack;
+    double Rem;
+    double SumRtPT;
+    double SumPT;
+    double SPT;
+    double LHA;
+    double MSS;
+    double WDT;
+    // all tracks, as the track jet 4-vector
+    double track_px, track_py, track_pz, track_e;
+
+    void Reset();
+    // Largest difference relative to the magnitude of each sum
+    double MaxRelativeDifference(const SubstructureSums& other) const;
+};
+
+
+enum class KernelMode {
+    Auto,      // AVX2 if the CPU has it, scalar otherwise
+    Scalar,
+    AVX2,
+    Validate   // scalar results, checked against AVX2
+};
+
+
+// Single-pass constituent kernels of the NTupler features, with a scalar
+// reference and an AVX2 version picked at runtime.
+class SubstructureKernels
+{
+  public:
+    static KernelMode mode;
+    static std::atomic<long long> validated;
+    static std::atomic<long long> mismatches;
+
+    static bool ParseMode(const std::string& name, KernelMode& result);
+    static bool HasAVX2();
+
+    // jet_p is the jet 3-momentum, used for the track projections of Qjet
+    static void Scalar(const JetConstituents& constituents, double jet_pt, const double jet_p[3], SubstructureSums& sums);
+    static void AVX2(const JetConstituents& constituents, double jet_pt, const double jet_p[3], SubstructureSums& sums);
+
+    // Runs the kernel selected by mode.
+    static void Compute(const JetConstituents& constituents, double jet_pt, const double jet_p[3], SubstructureSums& sums);
+
+    // Per-constituent steps, shared by the scalar kernel and the vector tails
+    static void AddTrack(const TrackColumns& tracks, size_t j, double jet_pt, const double jet_p[3], SubstructureSums& sums) {
+        sums.track_px += tracks.px[j];
+        sums.track_py += tracks.py[j];
+        sums.track_pz += tracks.pz[j];
+        sums.track_e += tracks.e[j];
+
+        double deltaR = tracks.delta_r[j];
+        double z = tracks.pt[j] / jet_pt;
+        double theta = deltaR / JET_CONE;
+
+        if (tracks.pt[j] < TRACK_MIN_PT) return;
+        sums.nCharged++;
+        double projection = pow(jet_p[0] * tracks.px[j] + jet_p[1] * tracks.py[j] + jet_p[2] * tracks.pz[j], 0.5);
+        sums.Qjet += tracks.charge[j] * projection; //q jet pT weighted
+        sums.Rtrack += tracks.pt[j] * deltaR; //deltaR pt weighted
+
+        sums.SumPT += projection; //used for: Qjet
+        sums.SumRtPT += tracks.pt[j]; //sum of the track pt
+
+        sums.LHA += z * sqrt(theta);
+        sums.SPT += z * z; //ptd_square
+        sums.WDT += z * theta;
+        sums.MSS += z * theta * theta;
+    }
+
+    static void AddTower(const TowerColumns& towers, size_t j, double jet_pt, SubstructureSums& sums) {
+        double deltaR = towers.delta_r[j];
+        double z = towers.et[j] / jet_pt;
+        double theta = deltaR / JET_CONE;
+        sums.Rem += towers.eem[j] * deltaR; //deltaR EM reweighted
+
+        if (deltaR >= JET_CONE) return;
+
+        int cone = (int) floor(deltaR / JET_CONE_STEP);
+        sums.Econe[cone] += towers.et[j]; //summing transverse energy in a cone of 0.1, 0.2,  0.3 and 0.4
+        sums.Eecone[cone] += towers.eem[j] / towers.cosh_eta[j];  //transverse em energy in cones
+
+        sums.LHA += z * sqrt(theta);
+        sums.SPT += z * z; //ptd_square
+        sums.WDT += z * theta;
+        sums.MSS += z * theta * theta;
+    }
+};
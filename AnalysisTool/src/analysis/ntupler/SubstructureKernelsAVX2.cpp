@@ -0,0 +1,144 @@
+#include "analysis/ntupler/SubstructureKernels.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+// Compiled for AVX2 regardless of the global flags; only called after
+// HasAVX2() said the CPU supports it.
+#define AVX2_TARGET __attribute__((target("avx2")))
+
+
+bool SubstructureKernels::HasAVX2() {
+    return __builtin_cpu_supports("avx2");
+}
+
+AVX2_TARGET static double HorizontalSum(__m256d value) {
+    __m128d low = _mm256_castpd256_pd128(value);
+    __m128d high = _mm256_extractf128_pd(value, 1);
+    low = _mm_add_pd(low, high);
+    return _mm_cvtsd_f64(_mm_add_sd(low, _mm_unpackhi_pd(low, low)));
+}
+
+AVX2_TARGET void SubstructureKernels::AVX2(const JetConstituents& constituents, double jet_pt, const double jet_p[3], SubstructureSums& sums) {
+    sums.Reset();
+
+    const __m256d zero = _mm256_setzero_pd();
+    const __m256d one = _mm256_set1_pd(1.);
+    const __m256d jet_pt_v = _mm256_set1_pd(jet_pt);
+    const __m256d cone = _mm256_set1_pd(JET_CONE);
+    const __m256d cone_step = _mm256_set1_pd(JET_CONE_STEP);
+    const __m256d min_pt = _mm256_set1_pd(TRACK_MIN_PT);
+    const __m256d jet_px = _mm256_set1_pd(jet_p[0]);
+    const __m256d jet_py = _mm256_set1_pd(jet_p[1]);
+    const __m256d jet_pz = _mm256_set1_pd(jet_p[2]);
+
+    __m256d lha = zero, spt = zero, wdt = zero, mss = zero;
+
+    // Tracks
+    const TrackColumns& tracks = constituents.tracks;
+    __m256d px = zero, py = zero, pz = zero, e = zero;
+    __m256d n_charged = zero, q_jet = zero, r_track = zero, sum_pt = zero, sum_rt_pt = zero;
+
+    size_t j = 0;
+    for (; j + 4 <= tracks.Size(); j += 4) {
+        __m256d track_px = _mm256_loadu_pd(&tracks.px[j]);
+        __m256d track_py = _mm256_loadu_pd(&tracks.py[j]);
+        __m256d track_pz = _mm256_loadu_pd(&tracks.pz[j]);
+        px = _mm256_add_pd(px, track_px);
+        py = _mm256_add_pd(py, track_py);
+        pz = _mm256_add_pd(pz, track_pz);
+        e = _mm256_add_pd(e, _mm256_loadu_pd(&tracks.e[j]));
+
+        __m256d pt = _mm256_loadu_pd(&tracks.pt[j]);
+        __m256d delta_r = _mm256_loadu_pd(&tracks.delta_r[j]);
+        // Same as the scalar "pt < min_pt: skip", NaN included
+        __m256d selected = _mm256_cmp_pd(pt, min_pt, _CMP_NLT_UQ);
+
+        __m256d dot = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(jet_px, track_px), _mm256_mul_pd(jet_py, track_py)),
+            _mm256_mul_pd(jet_pz, track_pz));
+        __m256d projection = _mm256_and_pd(selected, _mm256_sqrt_pd(dot));
+        __m256d z = _mm256_div_pd(pt, jet_pt_v);
+        __m256d theta = _mm256_div_pd(delta_r, cone);
+
+        n_charged = _mm256_add_pd(n_charged, _mm256_and_pd(selected, one));
+        q_jet = _mm256_add_pd(q_jet, _mm256_mul_pd(_mm256_loadu_pd(&tracks.charge[j]), projection));
+        r_track = _mm256_add_pd(r_track, _mm256_and_pd(selected, _mm256_mul_pd(pt, delta_r)));
+        sum_pt = _mm256_add_pd(sum_pt, projection);
+        sum_rt_pt = _mm256_add_pd(sum_rt_pt, _mm256_and_pd(selected, pt));
+
+        z = _mm256_and_pd(selected, z);
+        __m256d z_theta = _mm256_mul_pd(z, theta);
+        lha = _mm256_add_pd(lha, _mm256_mul_pd(z, _mm256_sqrt_pd(theta)));
+        spt = _mm256_add_pd(spt, _mm256_mul_pd(z, z));
+        wdt = _mm256_add_pd(wdt, z_theta);
+        mss = _mm256_add_pd(mss, _mm256_mul_pd(z_theta, theta));
+    }
+    for (; j < tracks.Size(); ++j)
+        AddTrack(tracks, j, jet_pt, jet_p, sums);
+
+    // Towers
+    const TowerColumns& towers = constituents.towers;
+    __m256d rem = zero;
+    __m256d econe[JET_CONE_N], eecone[JET_CONE_N];
+    for (int k = 0; k < JET_CONE_N; ++k)
+        econe[k] = eecone[k] = zero;
+
+    for (j = 0; j + 4 <= towers.Size(); j += 4) {
+        __m256d et = _mm256_loadu_pd(&towers.et[j]);
+        __m256d eem = _mm256_loadu_pd(&towers.eem[j]);
+        __m256d delta_r = _mm256_loadu_pd(&towers.delta_r[j]);
+
+        rem = _mm256_add_pd(rem, _mm256_mul_pd(eem, delta_r));
+
+        __m256d inside = _mm256_cmp_pd(delta_r, cone, _CMP_LT_OQ);
+        __m256d bin = _mm256_floor_pd(_mm256_div_pd(delta_r, cone_step));
+        __m256d eem_t = _mm256_div_pd(eem, _mm256_loadu_pd(&towers.cosh_eta[j]));
+        for (int k = 0; k < JET_CONE_N; ++k) {
+            __m256d in_bin = _mm256_and_pd(inside, _mm256_cmp_pd(bin, _mm256_set1_pd(k), _CMP_EQ_OQ));
+            econe[k] = _mm256_add_pd(econe[k], _mm256_and_pd(in_bin, et));
+            eecone[k] = _mm256_add_pd(eecone[k], _mm256_and_pd(in_bin, eem_t));
+        }
+
+        __m256d z = _mm256_and_pd(inside, _mm256_div_pd(et, jet_pt_v));
+        __m256d theta = _mm256_div_pd(delta_r, cone);
+        __m256d z_theta = _mm256_mul_pd(z, theta);
+        lha = _mm256_add_pd(lha, _mm256_mul_pd(z, _mm256_sqrt_pd(theta)));
+        spt = _mm256_add_pd(spt, _mm256_mul_pd(z, z));
+        wdt = _mm256_add_pd(wdt, z_theta);
+        mss = _mm256_add_pd(mss, _mm256_mul_pd(z_theta, theta));
+    }
+    for (; j < towers.Size(); ++j)
+        AddTower(towers, j, jet_pt, sums);
+
+    sums.track_px += HorizontalSum(px);
+    sums.track_py += HorizontalSum(py);
+    sums.track_pz += HorizontalSum(pz);
+    sums.track_e += HorizontalSum(e);
+    sums.nCharged += HorizontalSum(n_charged);
+    sums.Qjet += HorizontalSum(q_jet);
+    sums.Rtrack += HorizontalSum(r_track);
+    sums.SumPT += HorizontalSum(sum_pt);
+    sums.SumRtPT += HorizontalSum(sum_rt_pt);
+    sums.Rem += HorizontalSum(rem);
+    for (int k = 0; k < JET_CONE_N; ++k) {
+        sums.Econe[k] += HorizontalSum(econe[k]);
+        sums.Eecone[k] += HorizontalSum(eecone[k]);
+    }
+    sums.LHA += HorizontalSum(lha);
+    sums.SPT += HorizontalSum(spt);
+    sums.WDT += HorizontalSum(wdt);
+    sums.MSS += HorizontalSum(mss);
+}
+
+#else
+
+bool SubstructureKernels::HasAVX2() {
+    return false;
+}
+
+void SubstructureKernels::AVX2(const JetConstituents& constituents, double jet_pt, const double jet_p[3], SubstructureSums& sums) {
+    Scalar(constituents, jet_pt, jet_p, sums);
+}
+
+#endif
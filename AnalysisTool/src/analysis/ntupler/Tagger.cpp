@@ -0,0 +1,302 @@
+#include "analysis/ntupler/Tagger.hpp"
+#include "analysis/profiling/Profiler.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+
+
+// Tile sizes of the matrix product, chosen so a block of B (k x n floats)
+// stays in L1 while the rows of A stream through
+#define TAGGER_BLOCK_K 64
+#define TAGGER_BLOCK_N 64
+
+
+static bool ParseActivation(const std::string& name, Activation& result) {
+    if (name == "linear") result = Activation::Linear;
+    else if (name == "relu") result = Activation::ReLU;
+    else if (name == "tanh") result = Activation::Tanh;
+    else if (name == "sigmoid") result = Activation::Sigmoid;
+    else return false;
+    return true;
+}
+
+static void Activate(Activation activation, float* values, size_t size) {
+    switch (activation) {
+    case Activation::Linear:
+        break;
+    case Activation::ReLU:
+        for (size_t i = 0; i < size; ++i)
+            values[i] = std::max(values[i], 0.f);
+        break;
+    case Activation::Tanh:
+        for (size_t i = 0; i < size; ++i)
+            values[i] = std::tanh(values[i]);
+        break;
+    case Activation::Sigmoid:
+        for (size_t i = 0; i < size; ++i)
+            values[i] = 1.f / (1.f + std::exp(-values[i]));
+        break;
+    }
+}
+
+void Tagger::MatMulBias(const float* a, const float* b, const float* bias, float* c, size_t m, size_t k, size_t n) {
+    for (size_t row = 0; row < m; ++row)
+        std::copy(bias, bias + n, c + row * n);
+
+    for (size_t k0 = 0; k0 < k; k0 += TAGGER_BLOCK_K) {
+        size_t k1 = std::min(k, k0 + TAGGER_BLOCK_K);
+        for (size_t n0 = 0; n0 < n; n0 += TAGGER_BLOCK_N) {
+            size_t n1 = std::min(n, n0 + TAGGER_BLOCK_N);
+            for (size_t row = 0; row < m; ++row) {
+                const float* a_row = a + row * k;
+                float* c_row = c + row * n;
+                for (size_t i = k0; i < k1; ++i) {
+                    float a_value = a_row[i];
+                    const float* b_row = b + i * n;
+                    // Contiguous in n, vectorised by the compiler
+                    for (size_t j = n0; j < n1; ++j)
+                        c_row[j] += a_value * b_row[j];
+                }
+            }
+        }
+    }
+}
+
+size_t TaggerBranch::OutputSize() const {
+    size_t h = height, w = width, c = channels;
+    for (auto& layer: layers) {
+        switch (layer.type) {
+        case TaggerLayer::Dense: h = 1; w = 1; c = layer.outputs; break;
+        case TaggerLayer::Conv2D: c = layer.outputs; break;
+        case TaggerLayer::MaxPool2D: h /= layer.kernel_h; w /= layer.kernel_w; break;
+        case TaggerLayer::Flatten: c = h * w * c; h = 1; w = 1; break;
+        }
+    }
+    return h * w * c;
+}
+
+static bool ReadValues(std::istream& in, std::vector<float>& values, size_t size) {
+    values.resize(size);
+    for (auto& value: values)
+        if (!(in >> value)) return false;
+    return true;
+}
+
+bool Tagger::ReadBranch(std::istream& in, TaggerBranch& branch) {
+    size_t n_layers;
+    if (!(in >> branch.height >> branch.width >> branch.channels >> n_layers)) return false;
+
+    // Shape of the current row, to check the layer sizes
+    size_t h = branch.height, w = branch.width, c = branch.channels;
+    branch.layers.clear();
+    for (size_t l = 0; l < n_layers; ++l) {
+        TaggerLayer layer;
+        std::string type, activation;
+        if (!(in >> type)) return false;
+
+        if (type == "dense") {
+            layer.type = TaggerLayer::Dense;
+            if (!(in >> layer.inputs >> layer.outputs >> activation)) return false;
+            if (layer.inputs != h * w * c) return false;
+            h = 1; w = 1; c = layer.outputs;
+        } else if (type == "conv2d") {
+            layer.type = TaggerLayer::Conv2D;
+            size_t in_channels;
+            if (!(in >> layer.kernel_h >> layer.kernel_w >> in_channels >> layer.outputs >> activation)) return false;
+            if (in_channels != c) return false;
+            layer.inputs = layer.kernel_h * layer.kernel_w * in_channels;
+            c = layer.outputs;
+        } else if (type == "maxpool2d") {
+            layer.type = TaggerLayer::MaxPool2D;
+            if (!(in >> layer.kernel_h >> layer.kernel_w)) return false;
+            if (layer.kernel_h == 0 || layer.kernel_w == 0) return false;
+            h /= layer.kernel_h; w /= layer.kernel_w;
+        } else if (type == "flatten") {
+            layer.type = TaggerLayer::Flatten;
+            c = h * w * c; h = 1; w = 1;
+        } else {
+            return false;
+        }
+
+        if (layer.type == TaggerLayer::Dense || layer.type == TaggerLayer::Conv2D) {
+            if (!ParseActivation(activation, layer.activation)) return false;
+            if (!ReadValues(in, layer.weights, layer.inputs * layer.outputs)) return false;
+            if (!ReadValues(in, layer.bias, layer.outputs)) return false;
+        }
+        branch.layers.push_back(std::move(layer));
+    }
+    return true;
+}
+
+bool Tagger::Load(const std::string& path) {
+    std::ifstream in(path);
+    std::string magic;
+    int version;
+    if (!in || !(in >> magic >> version) || magic != "ds_tagger" || version != 1) {
+        std::cerr << path << " is not a tagger weights file." << std::endl;
+        return false;
+    }
+
+    std::string section;
+    while (in >> section) {
+        bool valid = true;
+        if (section == "features") {
+            size_t n;
+            valid = (bool) (in >> n);
+            feature_names.resize(valid ? n : 0);
+            for (auto& name: feature_names)
+                valid = valid && (in >> name);
+            valid = valid && ReadBranch(in, features);
+            has_features = true;
+        } else if (section == "image") {
+            valid = ReadBranch(in, image);
+            has_image = true;
+        } else if (section == "head") {
+            valid = ReadBranch(in, head);
+        } else if (section == "end") {
+            break;
+        } else {
+            valid = false;
+        }
+
+        if (!valid) {
+            std::cerr << "Invalid " << section << " section in " << path << "." << std::endl;
+            return false;
+        }
+    }
+
+    if (has_features && features.channels != feature_names.size()) {
+        std::cerr << "The feature branch of " << path << " does not match its features." << std::endl;
+        return false;
+    }
+    size_t combined = (has_features ? features.OutputSize() : 0) + (has_image ? image.OutputSize() : 0);
+    if ((!has_features && !has_image) || head.channels != combined ||
+        (head.layers.empty() ? combined : head.OutputSize()) != 1) {
+        std::cerr << "The branches of " << path << " do not end in one score." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+const std::vector<float>& Tagger::Run(TaggerBranch& branch, const std::vector<float>& input, size_t batch,
+                                      std::vector<float>& a, std::vector<float>& b) {
+    size_t h = branch.height, w = branch.width, c = branch.channels;
+    const std::vector<float>* current = &input;
+    std::vector<float>* next = &a;
+
+    for (auto& layer: branch.layers) {
+        const float* x = current->data();
+
+        switch (layer.type) {
+        case TaggerLayer::Dense: {
+            // One matrix product for the whole batch
+            next->resize(batch * layer.outputs);
+            MatMulBias(x, layer.weights.data(), layer.bias.data(), next->data(), batch, layer.inputs, layer.outputs);
+            Activate(layer.activation, next->data(), next->size());
+            h = 1; w = 1; c = layer.outputs;
+            break;
+        }
+        case TaggerLayer::Conv2D: {
+            // 'same' padding, stride 1: im2col rows are the output pixels of all jets
+            size_t pad_top = (layer.kernel_h - 1) / 2, pad_left = (layer.kernel_w - 1) / 2;
+            size_t pixels = batch * h * w;
+            columns.assign(pixels * layer.inputs, 0.f);
+
+            for (size_t jet = 0; jet < batch; ++jet) {
+                const float* jet_x = x + jet * h * w * c;
+                for (size_t y = 0; y < h; ++y) {
+                    for (size_t xx = 0; xx < w; ++xx) {
+                        float* column = columns.data() + ((jet * h + y) * w + xx) * layer.inputs;
+                        for (size_t ky = 0; ky < layer.kernel_h; ++ky) {
+                            long long sy = (long long) (y + ky) - (long long) pad_top;
+                            if (sy < 0 || sy >= (long long) h) continue;
+                            for (size_t kx = 0; kx < layer.kernel_w; ++kx) {
+                                long long sx = (long long) (xx + kx) - (long long) pad_left;
+                                if (sx < 0 || sx >= (long long) w) continue;
+                                std::copy(jet_x + (sy * w + sx) * c, jet_x + (sy * w + sx + 1) * c,
+                                          column + (ky * layer.kernel_w + kx) * c);
+                            }
+                        }
+                    }
+                }
+            }
+
+            next->resize(pixels * layer.outputs);
+            MatMulBias(columns.data(), layer.weights.data(), layer.bias.data(), next->data(), pixels, layer.inputs,
+                       layer.outputs);
+            Activate(layer.activation, next->data(), next->size());
+            c = layer.outputs;
+            break;
+        }
+        case TaggerLayer::MaxPool2D: {
+            // 'valid' padding, stride equal to the window
+            size_t out_h = h / layer.kernel_h, out_w = w / layer.kernel_w;
+            next->resize(batch * out_h * out_w * c);
+            for (size_t jet = 0; jet < batch; ++jet) {
+                for (size_t y = 0; y < out_h; ++y) {
+                    for (size_t xx = 0; xx < out_w; ++xx) {
+                        float* out = next->data() + ((jet * out_h + y) * out_w + xx) * c;
+                        std::fill(out, out + c, -INFINITY);
+                        for (size_t ky = 0; ky < layer.kernel_h; ++ky) {
+                            for (size_t kx = 0; kx < layer.kernel_w; ++kx) {
+                                const float* in = x + ((jet * h + y * layer.kernel_h + ky) * w + xx * layer.kernel_w + kx) * c;
+                                for (size_t ch = 0; ch < c; ++ch)
+                                    out[ch] = std::max(out[ch], in[ch]);
+                            }
+                        }
+                    }
+                }
+            }
+            h = out_h; w = out_w;
+            break;
+        }
+        case TaggerLayer::Flatten:
+            // Rows are already stored height, width, channel major
+            c = h * w * c; h = 1; w = 1;
+            continue;
+        }
+
+        current = next;
+        next = (next == &a) ? &b : &a;
+    }
+
+    if (current == &input) {
+        a = input;
+        return a;
+    }
+    return *current;
+}
+
+Activation Tagger::ScoreActivation() const {
+    const TaggerBranch& last = !head.layers.empty() ? head : has_image ? image : features;
+    return last.layers.empty() ? Activation::Linear : last.layers.back().activation;
+}
+
+void Tagger::Score(const float* feature_values, const float* image_values, size_t batch, float* scores) {
+    PROFILE_SCOPE("Tagger::Score");
+
+    size_t feature_out = has_features ? features.OutputSize() : 0;
+    size_t image_out = has_image ? image.OutputSize() : 0;
+    size_t combined = feature_out + image_out;
+    concatenated.resize(batch * combined);
+
+    if (has_features) {
+        input.assign(feature_values, feature_values + batch * feature_names.size());
+        const std::vector<float>& out = Run(features, input, batch, buffer_a, buffer_b);
+        for (size_t jet = 0; jet < batch; ++jet)
+            std::copy(out.data() + jet * feature_out, out.data() + (jet + 1) * feature_out,
+                      concatenated.data() + jet * combined);
+    }
+    if (has_image) {
+        input.assign(image_values, image_values + batch * image.height * image.width * image.channels);
+        const std::vector<float>& out = Run(image, input, batch, buffer_a, buffer_b);
+        for (size_t jet = 0; jet < batch; ++jet)
+            std::copy(out.data() + jet * image_out, out.data() + (jet + 1) * image_out,
+                      concatenated.data() + jet * combined + feature_out);
+    }
+
+    const std::vector<float>& out = Run(head, concatenated, batch, buffer_a, buffer_b);
+    std::copy(out.data(), out.data() + batch, scores);
+}
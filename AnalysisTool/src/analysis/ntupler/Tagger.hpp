@@ -0,0 +1,83 @@
+#pragma once
+
+#include <istream>
+#include <string>
+#include <vector>
+
+
+enum class Activation {
+    Linear,
+    ReLU,
+    Tanh,
+    Sigmoid
+};
+
+
+// One layer of an exported model. Dense and convolution weights are row-major
+// [inputs][outputs], for a convolution the inputs run over (kernel row,
+// kernel column, input channel) as in the Keras HWIO kernel.
+struct TaggerLayer
+{
+    enum Type { Dense, Conv2D, MaxPool2D, Flatten } type;
+    Activation activation = Activation::Linear;
+    size_t inputs = 0, outputs = 0;
+    // Conv2D kernel or MaxPool2D window
+    size_t kernel_h = 0, kernel_w = 0;
+    std::vector<float> weights;
+    std::vector<float> bias;
+};
+
+
+// A chain of layers applied to a batch of rows, with the shape of one row:
+// height x width x channels for images, 1 x 1 x n for feature vectors.
+struct TaggerBranch
+{
+    size_t height = 1, width = 1, channels = 0;
+    std::vector<TaggerLayer> layers;
+
+    // Output values per row
+    size_t OutputSize() const;
+};
+
+
+// Binary classifier exported from ml_tool with `ml_tool export`: a feature
+// branch and/or an image branch, whose outputs are concatenated (features
+// first) and passed through the head layers to one score per jet. Evaluates
+// batches of jets with cache-blocked matrix kernels; convolutions are
+// lowered to matrix products with im2col.
+class Tagger
+{
+  private:
+    std::vector<std::string> feature_names;
+    bool has_features = false;
+    bool has_image = false;
+    TaggerBranch features;
+    TaggerBranch image;
+    TaggerBranch head;
+
+    // Work buffers, reused between calls
+    std::vector<float> input, buffer_a, buffer_b, columns, concatenated;
+
+    bool ReadBranch(std::istream& in, TaggerBranch& branch);
+    // Runs a branch on batch rows of input, returns the buffer holding the output
+    const std::vector<float>& Run(TaggerBranch& branch, const std::vector<float>& input, size_t batch,
+                                  std::vector<float>& a, std::vector<float>& b);
+
+  public:
+    // Reads a weights file, prints the problem and returns false if it is invalid.
+    bool Load(const std::string& path);
+
+    const std::vector<std::string>& FeatureNames() const { return feature_names; }
+    bool HasImage() const { return has_image; }
+    size_t ImageDim() const { return image.height; }
+    size_t ImageChannels() const { return image.channels; }
+    // Activation of the last layer, which bounds the scores
+    Activation ScoreActivation() const;
+
+    // features: batch x FeatureNames().size() values, image: batch x dim x dim
+    // x channels in the jet_image layout. Writes one score per jet.
+    void Score(const float* features, const float* image, size_t batch, float* scores);
+
+    // C[m][n] = A[m][k] B[k][n] + bias[n], all row-major
+    static void MatMulBias(const float* a, const float* b, const float* bias, float* c, size_t m, size_t k, size_t n);
+};
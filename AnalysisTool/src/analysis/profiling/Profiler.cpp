@@ -0,0 +1,156 @@
+#include "analysis/profiling/Profiler.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <sys/resource.h>
+
+
+std::atomic<bool> Profiler::enabled(false);
+
+namespace {
+    std::mutex profiler_mutex;
+    std::vector<std::string> stage_names;
+    // One set of counters per thread, merged when reporting.
+    std::vector<std::unique_ptr<std::vector<StageStats>>> thread_stats;
+    thread_local std::vector<StageStats>* local_stats = nullptr;
+
+    size_t bucket_index(unsigned long long ns) {
+        if (ns < 4) return ns;
+        int octave = 63 - __builtin_clzll(ns);
+        size_t index = octave * 4 + ((ns >> (octave - 2)) & 3);
+        return std::min<size_t>(index, PROFILE_BUCKETS - 1);
+    }
+
+    double bucket_center(size_t index) {
+        if (index < 4) return index;
+        int octave = index / 4;
+        double width = std::ldexp(1.0, octave - 2);
+        return (4 + index % 4 + 0.5) * width;
+    }
+
+    std::vector<StageStats> merged_stats() {
+        std::vector<StageStats> merged(stage_names.size());
+        for (auto& stats: thread_stats)
+            for (size_t i = 0; i < stats->size() && i < merged.size(); ++i)
+                merged[i].Merge((*stats)[i]);
+        return merged;
+    }
+
+    long peak_rss_kb() {
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_maxrss;
+    }
+}
+
+
+void StageStats::Add(unsigned long long ns) {
+    calls++;
+    total_ns += ns;
+    max_ns = std::max(max_ns, ns);
+    buckets[bucket_index(ns)]++;
+}
+
+void StageStats::Merge(const StageStats& other) {
+    calls += other.calls;
+    total_ns += other.total_ns;
+    max_ns = std::max(max_ns, other.max_ns);
+    for (size_t i = 0; i < PROFILE_BUCKETS; ++i)
+        buckets[i] += other.buckets[i];
+}
+
+double StageStats::Percentile(double q) const {
+    unsigned long long rank = q * calls;
+    unsigned long long seen = 0;
+    for (size_t i = 0; i < PROFILE_BUCKETS; ++i) {
+        seen += buckets[i];
+        if (seen > rank)
+            return std::min<double>(bucket_center(i), max_ns);
+    }
+    return max_ns;
+}
+
+int Profiler::RegisterStage(const std::string& name) {
+    std::lock_guard<std::mutex> lock(profiler_mutex);
+
+    auto it = std::find(stage_names.begin(), stage_names.end(), name);
+    if (it != stage_names.end())
+        return it - stage_names.begin();
+
+    stage_names.push_back(name);
+    return stage_names.size() - 1;
+}
+
+void Profiler::Record(int stage, unsigned long long ns) {
+    if (local_stats == nullptr) {
+        std::lock_guard<std::mutex> lock(profiler_mutex);
+        thread_stats.emplace_back(new std::vector<StageStats>());
+        local_stats = thread_stats.back().get();
+    }
+    if ((size_t) stage >= local_stats->size())
+        local_stats->resize(stage + 1);
+
+    (*local_stats)[stage].Add(ns);
+}
+
+void Profiler::Report(std::ostream& out, long long events, double seconds) {
+    std::lock_guard<std::mutex> lock(profiler_mutex);
+    auto stats = merged_stats();
+
+    out << "** Processed " << events << " events in " << std::fixed << std::setprecision(2) << seconds
+        << " s (" << std::setprecision(1) << (seconds > 0 ? events / seconds : 0.) << " events/s)" << std::endl;
+    out << "** " << std::left << std::setw(40) << "Stage" << std::right
+        << std::setw(12) << "calls" << std::setw(12) << "total [s]"
+        << std::setw(12) << "p50 [us]" << std::setw(12) << "p99 [us]" << std::setw(12) << "max [us]" << std::endl;
+
+    for (size_t i = 0; i < stats.size(); ++i) {
+        if (stats[i].calls == 0) continue;
+        out << "** " << std::left << std::setw(40) << stage_names[i] << std::right
+            << std::setw(12) << stats[i].calls
+            << std::setw(12) << std::setprecision(3) << stats[i].total_ns * 1e-9
+            << std::setw(12) << std::setprecision(2) << stats[i].Percentile(0.5) * 1e-3
+            << std::setw(12) << stats[i].Percentile(0.99) * 1e-3
+            << std::setw(12) << stats[i].max_ns * 1e-3 << std::endl;
+    }
+    out << "** Peak RSS: " << peak_rss_kb() / 1024. << " MB" << std::endl;
+    out << std::defaultfloat;
+}
+
+bool Profiler::WriteJson(const std::string& path, long long events, double seconds, int threads) {
+    std::lock_guard<std::mutex> lock(profiler_mutex);
+    auto stats = merged_stats();
+
+    std::ofstream out(path);
+    if (!out) return false;
+
+    out << "{\n";
+    out << "  \"events\": " << events << ",\n";
+    out << "  \"wall_seconds\": " << seconds << ",\n";
+    out << "  \"events_per_second\": " << (seconds > 0 ? events / seconds : 0.) << ",\n";
+    out << "  \"threads\": " << threads << ",\n";
+    out << "  \"peak_rss_kb\": " << peak_rss_kb() << ",\n";
+    out << "  \"stages\": {";
+
+    bool first = true;
+    for (size_t i = 0; i < stats.size(); ++i) {
+        if (stats[i].calls == 0) continue;
+        out << (first ? "\n" : ",\n");
+        first = false;
+
+        out << "    \"" << stage_names[i] << "\": {"
+            << "\"calls\": " << stats[i].calls
+            << ", \"total_seconds\": " << stats[i].total_ns * 1e-9
+            << ", \"mean_us\": " << stats[i].total_ns * 1e-3 / stats[i].calls
+            << ", \"p50_us\": " << stats[i].Percentile(0.5) * 1e-3
+            << ", \"p99_us\": " << stats[i].Percentile(0.99) * 1e-3
+            << ", \"max_us\": " << stats[i].max_ns * 1e-3 << "}";
+    }
+    out << "\n  }\n}\n";
+    return true;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <ostream>
+#include <string>
+
+
+// Quarter-octave latency buckets: 4 per power of two nanoseconds.
+#define PROFILE_BUCKETS 256
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+
+// Times the enclosing scope as stage `name`. While profiling is switched off
+// at run time this costs a single branch, building with -DNO_PROFILING
+// removes the timers altogether.
+#ifdef NO_PROFILING
+#define PROFILE_SCOPE(name)
+#else
+#define PROFILE_SCOPE(name) \
+    static const int PROFILE_CONCAT(profile_stage_, __LINE__) = Profiler::RegisterStage(name); \
+    ScopedTimer PROFILE_CONCAT(profile_timer_, __LINE__)(PROFILE_CONCAT(profile_stage_, __LINE__))
+#endif
+
+
+struct StageStats
+{
+    unsigned long long calls = 0;
+    unsigned long long total_ns = 0;
+    unsigned long long max_ns = 0;
+    std::array<unsigned long long, PROFILE_BUCKETS> buckets{};
+
+    void Add(unsigned long long ns);
+    void Merge(const StageStats& other);
+    // Approximate quantile q in [0, 1], in nanoseconds.
+    double Percentile(double q) const;
+};
+
+
+class Profiler
+{
+  public:
+    // Read by the timers on every thread, only switched while no timed
+    // scope is running.
+    static std::atomic<bool> enabled;
+
+    static int RegisterStage(const std::string& name);
+    static void Record(int stage, unsigned long long ns);
+
+    // Prints events/s, the per-stage latencies and the peak RSS.
+    static void Report(std::ostream& out, long long events, double seconds);
+    static bool WriteJson(const std::string& path, long long events, double seconds, int threads);
+};
+
+
+class ScopedTimer
+{
+  private:
+    int stage;
+    bool active;
+    std::chrono::steady_clock::time_point start;
+
+  public:
+    explicit ScopedTimer(int stage) : stage(stage), active(Profiler::enabled.load(std::memory_order_relaxed)) {
+        if (active)
+            start = std::chrono::steady_clock::now();
+    }
+
+    ~ScopedTimer() {
+        if (active)
+            Profiler::Record(stage, std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count());
+    }
+};
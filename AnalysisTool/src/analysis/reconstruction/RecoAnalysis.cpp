@@ -1,13 +1,16 @@
 #include "analysis/reconstruction/RecoAnalysis.hpp"
+#include "analysis/profiling/Profiler.hpp"
 
 #include <iostream>
 
 
-RecoAnalysis::RecoAnalysis(ExRootTreeReader* reader) {
-    jets = reader->UseBranch("Jet");
-    photons = reader->UseBranch("Photon");
-    electrons = reader->UseBranch("Electron");
-    muons = reader->UseBranch("Muon");
+RecoAnalysis::RecoAnalysis(EventReader* reader): reader(reader) {
+    // Jets and photons are read from the EventView
+    reader->UseBranch("Jet");
+    reader->UseBranch("Photon");
+    // Only the multiplicities of the leptons are used
+    electron_size = reader->UseBranchSize("Electron");
+    muon_size = reader->UseBranchSize("Muon");
     met = reader->UseBranch("MissingET");
 
     reco_photon_n = new TH1D("reco_photon_n", "Reconstructed Photon multiplicity", 5, 0., 5.);
@@ -30,29 +33,30 @@ RecoAnalysis::RecoAnalysis(ExRootTreeReader* reader) {
 }
 
 void RecoAnalysis::ProcessEvent() {
+    PROFILE_SCOPE("RecoAnalysis::ProcessEvent");
 
-    numJets = jets->GetEntriesFast();
-    numPhotons = photons->GetEntriesFast();
-    numMuons = muons->GetEntriesFast();
-    numElectrons = electrons->GetEntriesFast();
+    numMuons = *muon_size;
+    numElectrons = *electron_size;
 
 
+    const EventView& view = reader->GetEventView();
+    const KinematicColumns& ph = view.photons;
+    const KinematicColumns& jt = view.jets;
+
     v_photons.clear();
     v_jets.clear();
     //photons
-    for (long long i = 0; i < numPhotons; ++i) {
-        Photon *ph = (Photon*) photons->At(i);
+    for (size_t i = 0; i < ph.Size(); ++i) {
         //premature photon selection
-        if (ph->PT < 20.) continue;
-        v_photons.push_back(ph->P4());
+        if (ph.pt[i] < 20.) continue;
+        v_photons.push_back(i);
     }
 
     //jets
-    for (long long i = 0; i < numJets; ++i) {
-        Jet *jet = (Jet*) jets->At(i);
+    for (size_t i = 0; i < jt.Size(); ++i) {
         //premature jet selection
-        if (jet->PT < 25.) continue;
-        v_jets.push_back(jet->P4());
+        if (jt.pt[i] < 25.) continue;
+        v_jets.push_back(i);
     }
 
     //numbers of photons and jets
@@ -68,11 +72,11 @@ void RecoAnalysis::ProcessEvent() {
     size_t jet, photon;
     bool found = false;
 
-    for(size_t p = 0; p < v_photons.size(); p++)
+    for (size_t p: v_photons)
     {
-        for(size_t j = 0; j < v_jets.size(); j++)
+        for (size_t j: v_jets)
         {
-            double dphi = abs(v_photons[p].DeltaPhi(v_jets[j]));
+            double dphi = std::abs(DeltaPhi(ph.phi[p], jt.phi[j]));
             if (dphi > max_dphi) {
                 max_dphi = dphi;
                 jet = j;
@@ -84,20 +88,43 @@ void RecoAnalysis::ProcessEvent() {
 
     if (!found) return;
 
-    TLorentzVector w = v_photons[photon] + v_jets[jet];
+    // Only the chosen pair needs 4-vectors
+    TLorentzVector v_photon, v_jet;
+    v_photon.SetPtEtaPhiM(ph.pt[photon], ph.eta[photon], ph.phi[photon], 0.);
+    v_jet.SetPtEtaPhiM(jt.pt[jet], jt.eta[jet], jt.phi[jet], jt.mass[jet]);
+    TLorentzVector w = v_photon + v_jet;
 
-    reco_w_photon_pT->Fill(v_photons[photon].Pt());
-    reco_w_photon_eta->Fill(v_photons[photon].Eta());
-    reco_w_photon_phi->Fill(v_photons[photon].Phi());
-    reco_w_jet_pT->Fill(v_jets[jet].Pt());
-    reco_w_jet_eta->Fill(v_jets[jet].Eta());
-    reco_w_jet_phi->Fill(v_jets[jet].Phi());
+    reco_w_photon_pT->Fill(ph.pt[photon]);
+    reco_w_photon_eta->Fill(ph.eta[photon]);
+    reco_w_photon_phi->Fill(ph.phi[photon]);
+    reco_w_jet_pT->Fill(jt.pt[jet]);
+    reco_w_jet_eta->Fill(jt.eta[jet]);
+    reco_w_jet_phi->Fill(jt.phi[jet]);
 
     reco_w_mass->Fill(w.M());
     reco_w_pT->Fill(w.Pt());
-    reco_w_deltaPhi->Fill(v_photons[photon].DeltaPhi(v_jets[jet]));
-    reco_w_deltaEta->Fill(fabs(v_photons[photon].Eta()-v_jets[jet].Eta()));
-    reco_w_deltaR->Fill(v_photons[photon].DeltaR(v_jets[jet]));
+    reco_w_deltaPhi->Fill(DeltaPhi(ph.phi[photon], jt.phi[jet]));
+    reco_w_deltaEta->Fill(fabs(ph.eta[photon] - jt.eta[jet]));
+    reco_w_deltaR->Fill(DeltaR(ph.eta[photon], ph.phi[photon], jt.eta[jet], jt.phi[jet]));
+}
+
+std::vector<std::string> RecoAnalysis::RequiredBranches() const {
+    return {
+        "Jet.PT", "Jet.Eta", "Jet.Phi", "Jet.Mass",
+        "Photon.PT", "Photon.Eta", "Photon.Phi",
+        "Electron_size", "Muon_size",
+        "MissingET.MET", "MissingET.Eta", "MissingET.Phi"
+    };
+}
+
+void RecoAnalysis::Merge(TDirectory* partial) {
+    for (TH1* hist: std::vector<TH1*>{reco_photon_n, reco_jet_n, reco_electron_n, reco_muon_n,
+            reco_w_photon_pT, reco_w_photon_eta, reco_w_photon_phi, reco_w_jet_pT, reco_w_jet_eta, reco_w_jet_phi,
+            reco_w_mass, reco_w_pT, reco_w_deltaPhi, reco_w_deltaEta, reco_w_deltaR}) {
+        TH1* partial_hist = partial->Get<TH1>(hist->GetName());
+        if (partial_hist != nullptr)
+            hist->Add(partial_hist);
+    }
 }
 
 void RecoAnalysis::Finalize() {}
\ No newline at end of file
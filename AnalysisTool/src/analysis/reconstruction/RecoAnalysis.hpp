@@ -2,7 +2,7 @@
 
 #include "TClonesArray.h"
 #include "classes/DelphesClasses.h"
-#include "external/ExRootAnalysis/ExRootTreeReader.h"
+#include "analysis/io/EventReader.hpp"
 
 #include "analysis/AnalysisTool.hpp"
 
@@ -14,22 +14,19 @@
 class RecoAnalysis: AnalysisTool
 {
   private:
-    long long numPhotons;
-    TClonesArray *photons;
-    
-    long long numJets;
-    TClonesArray *jets;
+    EventReader* reader;
 
     long long numElectrons;
-    TClonesArray *electrons;
+    const Int_t* electron_size;
 
     long long numMuons;
-    TClonesArray *muons;
+    const Int_t* muon_size;
 
     TClonesArray *met;
 
-    std::vector<TLorentzVector> v_jets; 
-    std::vector<TLorentzVector> v_photons; 
+    // Indices into the EventView columns of the preselected objects
+    std::vector<size_t> v_jets;
+    std::vector<size_t> v_photons;
 
 
     TH1D* reco_photon_n;
@@ -51,7 +48,9 @@ class RecoAnalysis: AnalysisTool
     TH1D* reco_w_deltaR;
 
   public:
-    RecoAnalysis(ExRootTreeReader*);
+    RecoAnalysis(EventReader*);
     virtual void ProcessEvent();
+    virtual std::vector<std::string> RequiredBranches() const;
+    virtual void Merge(TDirectory* partial);
     virtual void Finalize();
 };
\ No newline at end of file
@@ -0,0 +1,128 @@
+#include "analysis/truth/DecayGraph.hpp"
+
+#include <cstdlib>
+
+
+std::vector<std::string> DecayGraph::RequiredBranches() {
+    return {
+        "Particle.PID", "Particle.Status", "Particle.M1", "Particle.M2", "Particle.D1", "Particle.D2", "Particle.Charge",
+        "Particle.E", "Particle.Px", "Particle.Py", "Particle.Pz", "Particle.PT", "Particle.Eta", "Particle.Phi"
+    };
+}
+
+void DecayGraph::Build(TClonesArray* truthParticles) {
+    long long n = truthParticles->GetEntriesFast();
+
+    particles.resize(n);
+    pids.resize(n);
+    parents.resize(n);
+    daughters.resize(n);
+    for (auto& entry: pid_index)
+        entry.second.clear();
+
+    for (long long i = 0; i < n; ++i) {
+        GenParticle* particle = (GenParticle*) truthParticles->At(i);
+        particles[i] = particle;
+        pids[i] = abs(particle->PID);
+        parents[i] = (particle->M1 < 0 || particle->M1 >= n) ? -1 : particle->M1;
+        pid_index[pids[i]].push_back(i);
+    }
+
+    // 0: unresolved, 1: in progress (guards against broken records), 2: done
+    std::vector<char> state(n, 0);
+    for (long long i = n - 1; i >= 0; --i)
+        ResolveDaughters(i, state);
+}
+
+std::pair<long long, long long> DecayGraph::ResolveDaughters(long long index, std::vector<char>& state) {
+    if (state[index] == 2) return daughters[index];
+    if (state[index] == 1) return std::make_pair(-1, -1);
+    state[index] = 1;
+
+    GenParticle* particle = particles[index];
+    long long n = particles.size();
+    std::pair<long long, long long> result(-1, -1);
+
+    if (particle->D1 >= 0 && particle->D1 < n) {
+        if (particle->D1 == particle->D2 && particles[particle->D1]->PID == particle->PID) {
+            // special case where only status changed
+            result = ResolveDaughters(particle->D1, state);
+        } else if (particle->D2 < 0 || particle->D2 >= n || particle->D1 == particle->D2) {
+            result = std::make_pair((long long) particle->D1, -1ll);
+        } else {
+            result = std::make_pair((long long) particle->D1, (long long) particle->D2);
+        }
+    }
+
+    daughters[index] = result;
+    state[index] = 2;
+    return result;
+}
+
+const std::vector<long long>& DecayGraph::WithPID(int pid) const {
+    static const std::vector<long long> none;
+
+    auto it = pid_index.find(pid);
+    return it == pid_index.end() ? none : it->second;
+}
+
+bool DecayGraph::HasPID(long long index, int pid) const {
+    // Valid particle index passed?
+    if (index < 0 || index >= Size()) return false;
+
+    return pids[index] == pid;
+}
+
+long long DecayGraph::GetParent(long long index) const {
+    // Valid particle index passed?
+    if (index < 0 || index >= Size()) return -1;
+
+    return parents[index];
+}
+
+long long DecayGraph::GetParentOfType(long long index, int pid) const {
+    long long i_parent = GetParent(index);
+
+    if (!HasPID(i_parent, pid)) return -1;
+    return i_parent;
+}
+
+std::pair<long long, long long> DecayGraph::GetDaughters(long long index) const {
+    // Valid particle index passed?
+    if (index < 0 || index >= Size()) return std::make_pair(-1, -1);
+
+    return daughters[index];
+}
+
+long long DecayGraph::GetSibling(long long index) const {
+    long long i_parent = GetParent(index);
+
+    // Valid parent?
+    if (i_parent < 0) return -1;
+
+    std::pair<long long, long long> i_daughters = daughters[i_parent];
+
+    if (i_daughters.first == index && i_daughters.second != index) {
+        return i_daughters.second;
+    } else if (i_daughters.second == index && i_daughters.first != index) {
+        return i_daughters.first;
+    }
+
+    // huh?
+    return -1;
+}
+
+long long DecayGraph::GetSiblingOfType(long long index, int pid) const {
+    long long siblingIndex = GetSibling(index);
+
+    if (!HasPID(siblingIndex, pid)) return -1;
+    return siblingIndex;
+}
+
+long long DecayGraph::GetDaughterOfType(long long index, int pid) const {
+    std::pair<long long, long long> i_daughters = GetDaughters(index);
+
+    if (HasPID(i_daughters.first, pid)) return i_daughters.first;
+    if (HasPID(i_daughters.second, pid)) return i_daughters.second;
+    return -1;
+}
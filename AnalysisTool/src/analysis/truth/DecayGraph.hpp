@@ -0,0 +1,46 @@
+#pragma once
+
+#include "TClonesArray.h"
+#include "classes/DelphesClasses.h"
+
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+
+// Index over the truth record of one event, built in a single pass over the
+// Particle branch. All lookups work on plain index arrays; daughters of
+// status-only copies (a single daughter with the same PID) are resolved to
+// the last copy up front.
+class DecayGraph
+{
+  private:
+    std::vector<GenParticle*> particles;
+    std::vector<int> pids;
+    std::vector<long long> parents;
+    std::vector<std::pair<long long, long long>> daughters;
+    std::unordered_map<int, std::vector<long long>> pid_index;
+
+    std::pair<long long, long long> ResolveDaughters(long long index, std::vector<char>& state);
+
+  public:
+    // Particle leaves needed to build the graph and use its particles.
+    static std::vector<std::string> RequiredBranches();
+
+    void Build(TClonesArray* truthParticles);
+
+    long long Size() const { return particles.size(); }
+    GenParticle* Get(long long index) const { return particles[index]; }
+
+    // Indices of all particles with |PID| == pid, in record order.
+    const std::vector<long long>& WithPID(int pid) const;
+
+    bool HasPID(long long index, int pid) const;
+    long long GetParent(long long index) const;
+    long long GetParentOfType(long long index, int pid) const;
+    std::pair<long long, long long> GetDaughters(long long index) const;
+    long long GetSibling(long long index) const;
+    long long GetSiblingOfType(long long index, int pid) const;
+    long long GetDaughterOfType(long long index, int pid) const;
+};
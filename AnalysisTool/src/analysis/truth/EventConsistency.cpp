@@ -1,133 +1,19 @@
 #include "analysis/truth/EventConsistency.hpp"
+#include "analysis/profiling/Profiler.hpp"
 
+#include <algorithm>
 #include <cmath>
 #include <iostream>
 #include <queue>
 #include <memory>
 #include <random>
 
-#define GENPARTICLE(X) ((GenParticle*) X)
 
-bool TruthEventConsistency::HasPID(long long index, int pid) {
-    // Valid particle index passed?
-    if (index < 0 || index >= numTruthParticles) return -1;
-
-    // Get particle
-    GenParticle *particle = GENPARTICLE(truthParticles->At(index));
-
-    return abs(particle->PID) == pid;
-}
-
-long long  TruthEventConsistency::GetParent(long long  index) {
-    // Valid particle index passed?
-    if (index < 0 || index >= numTruthParticles) return -1;
-
-    // Get particle
-    GenParticle *particle = GENPARTICLE(truthParticles->At(index));
-
-    // Valid parent particle?
-    if (particle->M1 < 0 || particle->M1 >= numTruthParticles) return -1;
-
-    return particle->M1;
-}
-
-long long  TruthEventConsistency::GetParentOfType(long long  index, int pid) {
-    // Valid particle index passed?
-    if (index < 0 || index >= numTruthParticles) return -1;
-
-    // Get parent
-    long long i_parent = GetParent(index);
-
-    // Valid parent?
-    if (i_parent < 0 || i_parent > numTruthParticles) return -1;
-
-    // Get parent particle
-    GenParticle *parent = GENPARTICLE(truthParticles->At(i_parent));
-
-    // Right PID?
-    //std::cout<<"Parent for particle index#"<<index<<"parent index#"<<i_parent<<" PID:"<<parent->PID<<std::endl;
-    if (abs(parent->PID) != pid) return -1;
-
-    return i_parent;
-}
-
-std::pair<long long, long long> TruthEventConsistency::GetDaughters(long long  index) {
-    // Valid particle index passed?
-    if (index < 0 || index >= numTruthParticles) return std::make_pair(-1, -1);
-
-    // Get particle
-    GenParticle *particle = GENPARTICLE(truthParticles->At(index));
-
-    // Valid parent particle?
-    if (particle->D1 < 0 || particle->D1 >= numTruthParticles) return std::make_pair(-1, -1);
-
-    // Special case propagate
-    if (particle->D1 == particle->D2) {
-        GenParticle *daughter = GENPARTICLE(truthParticles->At(particle->D1));
-        if (daughter->PID == particle->PID) {
-            // special case where only status changed
-            return GetDaughters(particle->D1);
-        }
-    }
-
-    if (particle->D2 < 0 || particle->D2 > numTruthParticles || particle->D1 == particle->D2) 
-        return std::make_pair(particle->D1, -1);
-
-    return std::make_pair(particle->D1, particle->D2);
-}
-
-long long TruthEventConsistency::GetSibling(long long index) {
-    // Valid particle index passed?
-    if (index < 0 || index >= numTruthParticles) return -1;
-
-    // Get parent
-    long long i_parent = GetParent(index);
-
-    // Valid parent?
-    if (i_parent < 0 || i_parent > numTruthParticles) return -1;
-
-    // Get daughters
-    std::pair<long long, long long> i_daughters = GetDaughters(i_parent);
-
-    if (i_daughters.first == index && i_daughters.second != index) {
-        return i_daughters.second;
-    } else if (i_daughters.second == index && i_daughters.first != index) {
-        return i_daughters.first;
-    }
-    
-    // huh?
-    return -1;
-}
-
-long long  TruthEventConsistency::GetSiblingOfType(long long index, int pid) {
-    long long siblingIndex = GetSibling(index);
-    if (siblingIndex < 0 || siblingIndex >= numTruthParticles) return -1;
-
-    GenParticle *sibling = GENPARTICLE(truthParticles->At(siblingIndex));
-    //std::cout<<"Sibling index#"<<index<<"parent index#"<<siblingIndex<<" PIDL "<<abs(sibling->PID)<<std::endl;
-    if (abs(sibling->PID) != pid) return -1;
-    return siblingIndex;
-}
-
-long long TruthEventConsistency::GetDaughterOfType(long long index, int pid) {
-    // Valid particle index passed?
-    if (index < 0 || index >= numTruthParticles) return -1;
-
-    // Get daughters
-    std::pair<long long, long long> i_daughters = GetDaughters(index);
-
-    if (i_daughters.first == -1) return -1;
-    if (HasPID(i_daughters.first, pid)) return i_daughters.first;
-    if (i_daughters.second == -1) return -1;
-    if (HasPID(i_daughters.second, pid)) return i_daughters.second;
-    return -1;
-}
-
-void TruthEventConsistency::QuickTreePrint(long long index) {
+void TruthEventConsistency::QuickTreePrint(const DecayGraph& graph, long long index) {
     if (index > 35) return;
 
-    for(long long i = 0; i < index+3; ++i) {
-        GenParticle *p = GENPARTICLE(truthParticles->At(i));
+    for(long long i = 0; i < std::min(index+3, graph.Size()); ++i) {
+        GenParticle *p = graph.Get(i);
 
         std::cout << i << "PID: " << p->PID
             << " Status: " << p->Status
@@ -140,7 +26,7 @@ void TruthEventConsistency::QuickTreePrint(long long index) {
     std::cout << std::endl << std::endl;
 }
 
-TruthEventConsistency::TruthEventConsistency(ExRootTreeReader* reader) {
+TruthEventConsistency::TruthEventConsistency(EventReader* reader): reader(reader) {
     w_energy = new TH1D("truth_w_energy", "W energy", 100, 0., 500.);
     w_pt = new TH1D("truth_w_pt", "W pt", 100, 0.0, 100.0);
     w_eta = new TH1D("truth_w_eta", "W eta", 80, -10., 10.0);
@@ -157,44 +43,50 @@ TruthEventConsistency::TruthEventConsistency(ExRootTreeReader* reader) {
     delta_ds_gamma = new TH2D("truth_delta_ds_gamma", "Delta Ds-Gamma", 40, -4., 4, 40, 0., 10.);
 
     jet_n = new TH1D("jet_n", "Truth jet multiplicity", 5, 0., 5.);
+    event_valid = new TH1D("truth_event_valid", "Truth event consistency (0: invalid, 1: valid)", 2, 0., 2.);
     //jet_delta_r = new TH1D("truth_gluon_jet_delta_r", "Delta-R truth jets", 60, 0., 6.);
     //jet_delta_phi = new TH1D("truth_jet_delta_phi", "Delta-Phi truth jets", 80, -4., 4);
     //jet_delta_eta = new TH1D("truth_jet_delta_eta", "Delta-Eta truth jets", 40, 0., 10.0);
     //jet_width_phi = new TH1D("truth_jet_width_phi", "Truth jets width in phi", 25, 0., 0.5);
     //jet_width_eta = new TH1D("truth_jet_wdth_eta", "Truth jets width in eta", 25, 0., 0.5);
 
-    truthParticles = reader->UseBranch("Particle");
+    reader->UseDecayGraph();
     genJets = reader->UseBranch("GenJet");
-    valid_events = 0;
-    invalid_events = 0;
 }
 
 
+std::vector<std::string> TruthEventConsistency::RequiredBranches() const {
+    std::vector<std::string> branches = DecayGraph::RequiredBranches();
+    branches.push_back("GenJet");
+    return branches;
+}
 
-GenParticle* TruthEventConsistency::GetDS() {
-    numTruthParticles = truthParticles->GetEntriesFast();
+long long TruthEventConsistency::FindDS(const DecayGraph& graph) {
+    for (long long i: graph.WithPID(PID_PARTICLE_DSPLUS)) {
+        long long i_photon = graph.GetSiblingOfType(i, PID_PARTICLE_PHOTON);
+        long long i_w = graph.GetParentOfType(i, PID_PARTICLE_W);
 
-    for (long long i = 0; i < numTruthParticles; ++i) {
-        if (!HasPID(i, PID_PARTICLE_DSPLUS)) continue;
+        if (i_photon >= 0 && i_w >= 0) return i;
+    }
 
-        long long i_photon = GetSiblingOfType(i, PID_PARTICLE_PHOTON);
-        long long i_w = GetParentOfType(i, PID_PARTICLE_W);
+    return -1;
+}
 
-        if (i_photon >= 0 && i_w >= 0) {
-            return (GenParticle*) truthParticles->At(i);
-        }
-    }
+GenParticle* TruthEventConsistency::GetDS() {
+    PROFILE_SCOPE("TruthEventConsistency::GetDS");
+    const DecayGraph& graph = reader->GetDecayGraph();
 
-    return nullptr;
+    long long i_ds = FindDS(graph);
+    return i_ds < 0 ? nullptr : graph.Get(i_ds);
 }
 
 
 std::pair<GenParticle*, GenParticle*> TruthEventConsistency::GetBkgParticles(bool quark) {
-    numTruthParticles = truthParticles->GetEntriesFast();
+    const DecayGraph& graph = reader->GetDecayGraph();
     GenParticle *one = nullptr, *two = nullptr;
 
-    for (long long i = 0; i < std::min(numTruthParticles, 50ll); ++i) {
-        GenParticle* me = GENPARTICLE(truthParticles->At(i));
+    for (long long i = 0; i < std::min(graph.Size(), 50ll); ++i) {
+        GenParticle* me = graph.Get(i);
         int pid = abs(me->PID);
         if (quark && (pid < 1 || pid > 6)) continue;
         if (!quark && pid != 21) continue;
@@ -220,20 +112,18 @@ std::pair<GenParticle*, GenParticle*> TruthEventConsistency::GetBkgParticles(boo
 
 
 void TruthEventConsistency::ProcessEvent() {
-    numTruthParticles = truthParticles->GetEntriesFast();
-
-    bool event_valid = false;
-    for (long long i = 0; i < numTruthParticles; ++i) {
+    PROFILE_SCOPE("TruthEventConsistency::ProcessEvent");
+    const DecayGraph& graph = reader->GetDecayGraph();
 
-        if (!HasPID(i, PID_PARTICLE_DSPLUS)) continue;
-
-        long long i_photon = GetSiblingOfType(i, PID_PARTICLE_PHOTON);
-        long long i_w = GetParentOfType(i, PID_PARTICLE_W);
+    bool valid = false;
+    for (long long i: graph.WithPID(PID_PARTICLE_DSPLUS)) {
+        long long i_photon = graph.GetSiblingOfType(i, PID_PARTICLE_PHOTON);
+        long long i_w = graph.GetParentOfType(i, PID_PARTICLE_W);
 
         if (i_photon >= 0 && i_w >= 0 ) {
-            GenParticle* ds = GENPARTICLE(truthParticles->At(i));
-            GenParticle* photon = GENPARTICLE(truthParticles->At(i_photon));
-            GenParticle* w = GENPARTICLE(truthParticles->At(i_w));
+            GenParticle* ds = graph.Get(i);
+            GenParticle* photon = graph.Get(i_photon);
+            GenParticle* w = graph.Get(i_w);
 
             TLorentzVector parent = w->P4();
 
@@ -253,26 +143,23 @@ void TruthEventConsistency::ProcessEvent() {
             delta_r_ds_gamma->Fill(ds->P4().DeltaR(photon->P4()));
             delta_ds_gamma->Fill(ds->P4().DeltaPhi(photon->P4()), abs(ds->Eta - photon->Eta));
 
-            event_valid = true;
+            valid = true;
             break;
         }
 
-        if (!event_valid) {
-            GenParticle* ds = GENPARTICLE(truthParticles->At(i));
-            GenParticle* parent = GENPARTICLE(truthParticles->At(ds->M1));
+        if (!valid) {
+            long long i_parent = graph.GetParent(i);
+            if (i_parent < 0) continue;
+
+            GenParticle* parent = graph.Get(i_parent);
             if (parent->PID == 24 && parent->M1 >= 0) {
-                QuickTreePrint(i);
+                QuickTreePrint(graph, i);
                 std::cout << "i: " << i << " gamma:" << i_photon << " w:" << i_w << std::endl;
             }
         }
     }
 
-    if (event_valid) {
-        valid_events++;
-    }
-    else {
-        invalid_events++;
-    }
+    event_valid->Fill(valid ? 1. : 0.);
 
     //check truth jets:
     numGenJets = genJets->GetEntriesFast(); 
@@ -303,6 +190,16 @@ void TruthEventConsistency::ProcessEvent() {
     }*/
 }
 
+void TruthEventConsistency::Merge(TDirectory* partial) {
+    for (TH1* hist: std::vector<TH1*>{w_energy, w_pt, w_eta, ds_energy, ds_pt, ds_charge, gamma_energy, gamma_pt,
+            delta_phi_ds_gamma, delta_eta_ds_gamma, delta_r_ds_gamma, delta_ds_gamma, jet_n, event_valid}) {
+        TH1* partial_hist = partial->Get<TH1>(hist->GetName());
+        if (partial_hist != nullptr)
+            hist->Add(partial_hist);
+    }
+}
+
 void TruthEventConsistency::Finalize() {
-    std::cout << "Found " << valid_events << " valid events and " << invalid_events << " invalid events." << std::endl;
+    std::cout << "Found " << (unsigned long long) event_valid->GetBinContent(2) << " valid events and "
+        << (unsigned long long) event_valid->GetBinContent(1) << " invalid events." << std::endl;
 }
\ No newline at end of file
@@ -4,9 +4,10 @@
 #include "TH2.h"
 #include "TClonesArray.h"
 #include "classes/DelphesClasses.h"
-#include "external/ExRootAnalysis/ExRootTreeReader.h"
 
 #include "analysis/AnalysisTool.hpp"
+#include "analysis/io/EventReader.hpp"
+#include "analysis/truth/DecayGraph.hpp"
 
 
 #define PID_PARTICLE_DSPLUS 431
@@ -17,9 +18,8 @@
 class TruthEventConsistency: AnalysisTool
 {
   private:
-    long long numTruthParticles;
+    EventReader* reader;
     long long numGenJets;
-    TClonesArray *truthParticles;
     TClonesArray *genJets;
 
     TH1D* w_energy;
@@ -44,23 +44,19 @@ class TruthEventConsistency: AnalysisTool
     //TH1D* jet_width_phi;
     //TH1D* jet_width_eta; 
 
-    unsigned long long valid_events;
-    unsigned long long invalid_events;
+    TH1D* event_valid;
 
-    bool HasPID(long long index, int pid);
-    long long GetParent(long long  index);
-    long long GetParentOfType(long long index, int pid);
-    std::pair<long long, long long> GetDaughters(long long index);
-    long long GetSibling(long long index);
-    long long GetSiblingOfType(long long index, int pid);
-    long long GetDaughterOfType(long long index, int pid);
-    void QuickTreePrint(long long index);
+    void QuickTreePrint(const DecayGraph& graph, long long index);
 
   public:
-    TruthEventConsistency(ExRootTreeReader*);
+    TruthEventConsistency(EventReader*);
     virtual void ProcessEvent();
+    virtual std::vector<std::string> RequiredBranches() const;
+    virtual void Merge(TDirectory* partial);
     virtual void Finalize();
 
+    // Index of the Ds with a photon sibling and a W parent, or -1.
+    static long long FindDS(const DecayGraph& graph);
     GenParticle* GetDS();
     std::pair<GenParticle*, GenParticle*> GetBkgParticles(bool quark);
 };
\ No newline at end of file
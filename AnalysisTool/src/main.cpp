@@ -1,18 +1,64 @@
 #include "external/ExRootAnalysis/ExRootTreeReader.h"
+#include "analysis/io/EventReader.hpp"
+#include "analysis/io/RunInfo.hpp"
+#include "analysis/profiling/Profiler.hpp"
 #include "analysis/truth/EventConsistency.hpp"
 #include "analysis/reconstruction/RecoAnalysis.hpp"
 #include "analysis/ntupler/NTupler.hpp"
 #include "analysis/plot/Plot.hpp"
 
+#include <cctype>
+#include <cerrno>
+#include <cmath>
 #include <cstring>
 #include <iostream>
 #include <vector>
 #include <memory>
 #include <string>
 #include <iomanip>
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstdio>
+#include <fnmatch.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <chrono>
+#include <limits>
+#include <new>
 
 #include "TFile.h"
-#include "TChain.h"
+#include "TMemFile.h"
+#include "TROOT.h"
+#include "TFileMerger.h"
+#include "TSystem.h"
+
+#include <tbb/parallel_for.h>
+#include <tbb/task_arena.h>
+
+
+struct AnalysisOptions
+{
+    int threads = 1;
+    // Worker processes, an alternative to threads for tools that are not thread safe
+    int procs = 1;
+    // Shard i of N, or an explicit [first_entry, last_entry) slice; a
+    // negative last_entry means the end of the chain.
+    int shard = 0;
+    int shards = 1;
+    long long first_entry = 0;
+    long long last_entry = -1;
+    // Read the branches only needed for selected events in a second step.
+    bool staged_read = false;
+    ReadOptions read;
+    // Timing report destination, profiling is off if empty.
+    std::string profile_file;
+    // Implementation of the ntupler substructure kernels.
+    KernelMode kernels = KernelMode::Auto;
+    NTuplerConfig ntupler;
+};
 
 
 int plotter(std::vector<std::string> files) {
@@ -31,33 +77,19 @@ int plotter(std::vector<std::string> files) {
 }
 
 
-int analysis(std::string in_file, std::string out_file, std::vector<std::string> tool_names)
+int build_tools(std::vector<std::string> tool_names, EventReader* reader, const NTuplerConfig& ntupler_config,
+    std::vector<AnalysisTool*>& tools, bool verbose)
 {
-    std::cout << "Running mode analysis." << std::endl;
-
-    TChain *chain = new TChain("Delphes");
-    chain->Add(in_file.c_str());
-
-    ExRootTreeReader *treeReader = new ExRootTreeReader(chain);
-
-    TFile* out = TFile::Open(out_file.c_str(), "CREATE");
-
-    if (out == nullptr || out->IsZombie()) {
-        std::cout << "Error opening output file, does it already exist?" << std::endl;
-        return 1;
-    }
-
-    std::vector<AnalysisTool*> tools;
-
     for (size_t i = 0; i < tool_names.size(); ++i) {
         auto operation = tool_names[i];
 
-        std::cout << "Adding operation " << operation << "." << std::endl;
+        if (verbose)
+            std::cout << "Adding operation " << operation << "." << std::endl;
         if (operation == "event_consistency") {
-            AnalysisTool* tool = (AnalysisTool*) new TruthEventConsistency(treeReader);
+            AnalysisTool* tool = (AnalysisTool*) new TruthEventConsistency(reader);
             tools.push_back(tool);
         } else if (operation == "reco") {
-            AnalysisTool* tool = (AnalysisTool*) new RecoAnalysis(treeReader);
+            AnalysisTool* tool = (AnalysisTool*) new RecoAnalysis(reader);
             tools.push_back(tool);
         } else if (operation == "ntupler") {
             if (i == tool_names.size() - 1) {
@@ -65,7 +97,7 @@ int analysis(std::string in_file, std::string out_file, std::vector<std::string>
                 return 1;
             }
 
-            AnalysisTool* tool = (AnalysisTool*) new NTupler(tool_names[i+1], treeReader);
+            AnalysisTool* tool = (AnalysisTool*) new NTupler(tool_names[i+1], reader, ntupler_config);
             i += 1;
             tools.push_back(tool);
         }else {
@@ -73,37 +105,651 @@ int analysis(std::string in_file, std::string out_file, std::vector<std::string>
             return 1;
         }
     }
+    return 0;
+}
 
-    long long entries = treeReader->GetEntries();
-    std::cout << "** Chain contains " << entries << " events." << std::endl;
 
-    for (long long entry = 0; entry < entries; ++entry) {
-        if (entry % 1000 == 0) 
+// True if `pattern` (as given to SetBranchStatus) covers `branch` or one of its sub-branches.
+bool branch_matches(const std::string& pattern, const std::string& branch)
+{
+    return fnmatch(pattern.c_str(), branch.c_str(), 0) == 0 || pattern.compare(0, branch.size() + 1, branch + ".") == 0;
+}
+
+
+void activate_branches(EventReader* reader, std::vector<AnalysisTool*>& tools, bool staged)
+{
+    std::vector<std::string> branches;
+    std::vector<std::string> deferred;
+
+    for (auto tool: tools) {
+        auto tool_branches = tool->RequiredBranches();
+        branches.insert(branches.end(), tool_branches.begin(), tool_branches.end());
+        if (!staged) continue;
+
+        for (auto& branch: tool->DeferredBranches()) {
+            if (std::find(deferred.begin(), deferred.end(), branch) == deferred.end())
+                deferred.push_back(branch);
+        }
+    }
+
+    // A branch can only be deferred if no tool needs it before its selection.
+    for (auto tool: tools) {
+        auto tool_deferred = tool->DeferredBranches();
+
+        for (auto& pattern: tool->RequiredBranches()) {
+            deferred.erase(std::remove_if(deferred.begin(), deferred.end(), [&](const std::string& branch) {
+                return std::find(tool_deferred.begin(), tool_deferred.end(), branch) == tool_deferred.end() &&
+                    branch_matches(pattern, branch);
+            }), deferred.end());
+        }
+    }
+
+    reader->SetActiveBranches(branches, deferred);
+}
+
+
+// Returns the entry after the last one read, which is before `last` if every
+// tool was saturated, or -1 if an entry could not be read.
+long long event_loop(EventReader* reader, std::vector<AnalysisTool*>& tools, long long first, long long last, bool progress)
+{
+    std::vector<bool> has_deferred;
+    for (auto tool: tools)
+        has_deferred.push_back(!tool->DeferredBranches().empty());
+
+    std::vector<bool> selected(tools.size());
+
+    for (long long entry = first; entry < last; ++entry) {
+        if (progress && entry % 1000 == 0)
             std::cout << "\r" << std::setfill(' ') << std::setw(12) << entry << " processed" << std::flush;
-        treeReader->ReadEntry(entry);
+        if (!reader->ReadEntry(entry)) {
+            std::cout << std::endl << "Error reading entry " << entry << "." << std::endl;
+            return -1;
+        }
+
+        bool read_deferred = false;
+        bool any_selected = false;
+        for (size_t i = 0; i < tools.size(); ++i) {
+            selected[i] = tools[i]->SelectEvent();
+            read_deferred |= selected[i] && has_deferred[i];
+            any_selected |= selected[i];
+        }
+
+        if (read_deferred)
+            reader->ReadDeferred();
+
+        for (size_t i = 0; i < tools.size(); ++i)
+            if (selected[i])
+                tools[i]->ProcessEvent();
+
+        // Tools only fill up in ProcessEvent
+        if (any_selected && std::all_of(tools.begin(), tools.end(), [](AnalysisTool* tool) { return tool->Saturated(); }))
+            return entry + 1;
+    }
+    return last;
+}
+
+
+void report_worker(int w, long long first, long long stopped, long long last, double input_seconds)
+{
+    std::cout << "** Worker " << w << " processed entries " << first << " to " << stopped;
+    if (stopped < last)
+        std::cout << " of " << last << ", its tools were saturated";
+    std::cout << "; " << input_seconds << " s waiting on input." << std::endl;
+}
+
+
+// Options of worker w of a --threads or --procs run. Only the main tools write
+// the .npy output, from the merged results, and the worker trees are filled on
+// the worker's thread as the merge reads them right after the event loop. The
+// ntupler jet cap is shared through `worker_jets`, one count per worker.
+AnalysisOptions worker_options(const AnalysisOptions& options, std::atomic<long long>* worker_jets = nullptr, int w = 0)
+{
+    AnalysisOptions worker = options;
+    worker.ntupler.npy_directory.clear();
+    worker.ntupler.output_queue = 0;
+    worker.ntupler.worker_jets = worker_jets;
+    worker.ntupler.worker = w;
+    return worker;
+}
+
+
+// The entries [first, last) of a worker; it read them up to `stopped`
+struct Block
+{
+    long long first;
+    long long last;
+    long long stopped;
+};
+
+
+// Adds the output of the worker of `block` to the main tools, which have merged
+// the earlier blocks, and counts its entries in `processed`. If the block would
+// saturate every tool, the main tools read it again instead, so they stop at
+// the same entry as a single pass and hold nothing of the later events.
+// Returns false once the tools are saturated, the later blocks are dropped; if
+// the block cannot be read again `processed` is set to -1.
+bool merge_block(EventReader* reader, std::vector<AnalysisTool*>& tools, TDirectory* output, const Block& block,
+                 const ReadOptions& read, long long& processed)
+{
+    if (!std::all_of(tools.begin(), tools.end(), [&](AnalysisTool* tool) { return tool->SaturatedAfterMerge(output); })) {
+        for (auto tool: tools)
+            tool->Merge(output);
+        processed += block.stopped - block.first;
+        return true;
+    }
+
+    std::cout << "** Reading entries " << block.first << " to " << block.stopped
+        << " again, the tools are saturated within them." << std::endl;
+    reader->SetReadOptions(read, block.first, block.stopped);
+    long long stopped = event_loop(reader, tools, block.first, block.stopped, false);
+    for (auto tool: tools)
+        tool->Flush();
+    processed = stopped < 0 ? -1 : processed + stopped - block.first;
+    return false;
+}
+
+
+struct Worker
+{
+    EventReader* reader;
+    TMemFile* file;
+    std::vector<AnalysisTool*> tools;
+    Block block;
+};
+
+
+// Splits [first, last) into contiguous blocks, one per worker. Every worker owns
+// its reader, tools and an in-memory output file; the results are merged into
+// the main tools in block order with merge_block, so the output equals a single
+// threaded run. A worker stops once the jets of the earlier blocks and its own
+// fill the ntupler cap. Returns the number of entries behind the output, or -1
+// if a worker could not read its block.
+long long threaded_event_loop(std::string in_file, EventReader* reader, std::vector<std::string> tool_names,
+                              std::vector<AnalysisTool*>& tools, long long first_entry, long long last_entry,
+                              AnalysisOptions options)
+{
+    int threads = options.threads;
+    ROOT::EnableThreadSafety();
+
+    std::vector<Worker> workers(threads);
+    std::unique_ptr<std::atomic<long long>[]> worker_jets(new std::atomic<long long>[threads]());
+
+    tbb::task_arena arena(threads);
+    arena.execute([&] {
+        tbb::parallel_for(0, threads, [&](int w) {
+            Worker& worker = workers[w];
+            long long first = first_entry + (last_entry - first_entry) * w / threads;
+            long long last = first_entry + (last_entry - first_entry) * (w + 1) / threads;
+
+            AnalysisOptions worker_opts = worker_options(options, worker_jets.get(), w);
+            worker.reader = new EventReader(in_file);
+            worker.file = new TMemFile(("worker_" + std::to_string(w) + ".root").c_str(), "RECREATE");
+            TDirectory::TContext context(worker.file);
+
+            build_tools(tool_names, worker.reader, worker_opts.ntupler, worker.tools, false);
+            activate_branches(worker.reader, worker.tools, worker_opts.staged_read);
+            worker.reader->SetReadOptions(worker_opts.read, first, last);
+            long long stopped = event_loop(worker.reader, worker.tools, first, last, false);
+            for (auto tool: worker.tools)
+                tool->Flush();
+            if (stopped >= 0)
+                report_worker(w, first, stopped, last, worker.reader->InputSeconds());
+            worker.block = {first, last, stopped};
+        }, tbb::simple_partitioner());
+    });
+
+    long long processed = 0;
+    bool merging = std::all_of(workers.begin(), workers.end(), [](const Worker& worker) { return worker.block.stopped >= 0; });
+    if (!merging)
+        processed = -1;
+    for (auto& worker: workers) {
+        if (merging)
+            merging = merge_block(reader, tools, worker.file, worker.block, options.read, processed);
+
+        for (auto tool: worker.tools)
+            delete tool;
+        worker.file->Close();
+        delete worker.file;
+        delete worker.reader;
+    }
+    return processed;
+}
+
+
+// Runs worker w of a forked_event_loop on [first, last) with the worker_options,
+// returns its exit status and stores the entry it stopped at in `stopped`.
+int process_worker(int w, std::string in_file, std::string worker_file, std::vector<std::string> tool_names,
+                   long long first, long long last, const AnalysisOptions& options, long long* stopped)
+{
+    // --prefetch opens the next file on a second thread while this one reads
+    if (options.read.prefetch)
+        ROOT::EnableThreadSafety();
+
+    EventReader* reader = new EventReader(in_file);
+    TFile* file = TFile::Open(worker_file.c_str(), "RECREATE");
+    if (file == nullptr || file->IsZombie()) {
+        std::cout << "** Worker " << w << " cannot write " << worker_file << "." << std::endl;
+        return 1;
+    }
+
+    std::vector<AnalysisTool*> tools;
+    {
+        TDirectory::TContext context(file);
+        if (build_tools(tool_names, reader, options.ntupler, tools, false) != 0)
+            return 1;
+        activate_branches(reader, tools, options.staged_read);
+        reader->SetReadOptions(options.read, first, last);
+        *stopped = event_loop(reader, tools, first, last, false);
+        for (auto tool: tools)
+            tool->Flush();
+    }
+    if (*stopped < 0)
+        return 1;
+    report_worker(w, first, *stopped, last, reader->InputSeconds());
+
+    file->Write();
+    file->Close();
+    return 0;
+}
+
+
+// Splits [first, last) into contiguous blocks like threaded_event_loop, but
+// runs every block in a forked process, so the tools and ROOT need not be
+// thread safe. Every worker builds its own reader and tools and writes them
+// to a private file next to the output; the main tools merge the files in
+// block order with merge_block, so the output equals a single process run.
+// Returns the number of entries behind the output, or -1 if a worker failed.
+long long forked_event_loop(std::string in_file, std::string out_file, EventReader* reader, std::vector<std::string> tool_names,
+                            std::vector<AnalysisTool*>& tools, long long first_entry, long long last_entry, AnalysisOptions options)
+{
+    int procs = options.procs;
+
+    std::vector<std::string> worker_files;
+    std::vector<Block> blocks;
+    std::vector<pid_t> pids;
+    bool failed = false;
+
+    // The stop entry and the jets written of every worker, shared with the
+    // children. The atomics are lock-free, so they work across processes.
+    size_t shared_size = procs * (sizeof(long long) + sizeof(std::atomic<long long>));
+    void* shared = mmap(nullptr, shared_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) {
+        std::cout << "Error sharing memory with the worker processes." << std::endl;
+        return -1;
+    }
+    long long* stopped = (long long*) shared;
+    std::atomic<long long>* worker_jets = (std::atomic<long long>*) (stopped + procs);
+    for (int w = 0; w < procs; ++w)
+        new (&worker_jets[w]) std::atomic<long long>(0);
+
+    // Buffered output would be written again by every child
+    std::cout << std::flush;
+    std::cerr << std::flush;
+
+    for (int w = 0; w < procs; ++w) {
+        long long first = first_entry + (last_entry - first_entry) * w / procs;
+        long long last = first_entry + (last_entry - first_entry) * (w + 1) / procs;
+        std::string worker_file = out_file + ".proc" + std::to_string(w) + ".root";
+
+        stopped[w] = first;
+
+        pid_t pid = fork();
+        if (pid == 0) {
+            // _exit: the child must not run the exit handlers, which would
+            // close the parent's output file.
+            int status = process_worker(w, in_file, worker_file, tool_names, first, last,
+                                        worker_options(options, worker_jets, w), &stopped[w]);
+            std::cout << std::flush;
+            std::cerr << std::flush;
+            _exit(status);
+        }
+        if (pid < 0) {
+            std::cout << "Error starting worker process " << w << "." << std::endl;
+            failed = true;
+            break;
+        }
+        worker_files.push_back(worker_file);
+        blocks.push_back({first, last, 0});
+        pids.push_back(pid);
+    }
+
+    for (size_t w = 0; w < pids.size(); ++w) {
+        int status;
+        if (waitpid(pids[w], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            std::cout << "Worker process " << w << " failed." << std::endl;
+            failed = true;
+        }
+    }
+
+    long long processed = 0;
+    bool merging = true;
+    for (size_t w = 0; w < worker_files.size(); ++w) {
+        const std::string& worker_file = worker_files[w];
+        if (!failed && merging) {
+            TFile* file = TFile::Open(worker_file.c_str(), "READ");
+            if (file == nullptr || file->IsZombie()) {
+                std::cout << "Error reading the worker output " << worker_file << "." << std::endl;
+                failed = true;
+            } else {
+                blocks[w].stopped = stopped[w];
+                merging = merge_block(reader, tools, file, blocks[w], options.read, processed);
+                file->Close();
+            }
+            delete file;
+        }
+        gSystem->Unlink(worker_file.c_str());
+    }
+
+    munmap(shared, shared_size);
+    return failed ? -1 : processed;
+}
+
+
+int analysis(std::string in_file, std::string out_file, std::vector<std::string> tool_names, AnalysisOptions options)
+{
+    std::cout << "Running mode analysis." << std::endl;
+
+    EventReader* reader = new EventReader(in_file);
+
+    TFile* out = TFile::Open(out_file.c_str(), "CREATE");
+
+    if (out == nullptr || out->IsZombie()) {
+        std::cout << "Error opening output file, does it already exist?" << std::endl;
+        return 1;
+    }
+    // Trees and histograms take the compression of the file when they are created
+    if (options.ntupler.output.compression >= 0)
+        out->SetCompressionSettings(options.ntupler.output.compression);
 
+    std::vector<AnalysisTool*> tools;
+    if (build_tools(tool_names, reader, options.ntupler, tools, true) != 0)
+        return 1;
+    activate_branches(reader, tools, options.staged_read);
+
+    long long entries = reader->GetEntries();
+    std::cout << "** Chain contains " << entries << " events." << std::endl;
+
+    RunInfo info;
+    info.chain_entries = entries;
+    info.input_files = reader->GetFileNames();
+    for (auto& name: tool_names)
+        info.configuration += (info.configuration.empty() ? "" : " ") + name;
+    if (std::find(tool_names.begin(), tool_names.end(), "ntupler") != tool_names.end())
+        info.configuration += " " + options.ntupler.Describe();
+
+    if (options.shards > 1) {
+        info.first_entry = entries * options.shard / options.shards;
+        info.last_entry = entries * (options.shard + 1) / options.shards;
+    } else {
+        info.first_entry = std::min(options.first_entry, entries);
+        info.last_entry = options.last_entry < 0 ? entries : std::min(options.last_entry, entries);
+    }
+
+    if (info.first_entry > info.last_entry) {
+        std::cout << "Empty entry range " << info.first_entry << ":" << info.last_entry << "." << std::endl;
+        return 1;
+    }
+    if (info.first_entry != 0 || info.last_entry != entries)
+        std::cout << "** Processing entries " << info.first_entry << " to " << info.last_entry << "." << std::endl;
+
+    SubstructureKernels::mode = options.kernels;
+    Profiler::enabled = !options.profile_file.empty();
+    auto start = std::chrono::steady_clock::now();
+
+    // Entries read, fewer than the range if every tool was saturated
+    long long events;
+    if (options.procs > 1) {
+        std::cout << "** Processing with " << options.procs << " worker processes." << std::endl;
+        events = forked_event_loop(in_file, out_file, reader, tool_names, tools, info.first_entry, info.last_entry, options);
+        if (events < 0)
+            return 1;
+    } else if (options.threads > 1) {
+        std::cout << "** Processing with " << options.threads << " threads." << std::endl;
+        events = threaded_event_loop(in_file, reader, tool_names, tools, info.first_entry, info.last_entry, options);
+        if (events < 0)
+            return 1;
+    } else {
+        // Parallel unzipping for --prefetch. Workers are not given the pool,
+        // it would compete with them and with the output compression.
+        if (options.read.prefetch) {
+            ROOT::EnableThreadSafety();
+            ROOT::EnableImplicitMT();
+        }
+        reader->SetReadOptions(options.read, info.first_entry, info.last_entry);
+        long long stopped = event_loop(reader, tools, info.first_entry, info.last_entry, true);
+        if (stopped < 0)
+            return 1;
+        events = stopped - info.first_entry;
+        // Output still queued belongs to the timed event loop
         for (auto tool: tools)
-            tool->ProcessEvent();
+            tool->Flush();
+        std::cout << std::endl;
+        if (stopped < info.last_entry)
+            std::cout << "** Stopped after entry " << stopped - 1 << ", every tool was saturated; skipped "
+                << info.last_entry - stopped << " of " << info.last_entry - info.first_entry << " entries." << std::endl;
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "** Event loop took " << seconds << " s, " << reader->InputSeconds() << " s ("
+            << 100. * reader->InputSeconds() / std::max(seconds, 1e-9) << "%) waiting on input." << std::endl;
+    }
+
+    info.stopped_entry = info.first_entry + events;
+
+    if (Profiler::enabled) {
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        Profiler::Report(std::cout, events, seconds);
+        if (!Profiler::WriteJson(options.profile_file, events, seconds, options.threads))
+            std::cout << "Error writing profile to " << options.profile_file << "." << std::endl;
+        Profiler::enabled = false;
     }
-    std::cout << std::endl;
 
+    out->cd();
     for (auto tool: tools)
         tool->Finalize();
 
     for (auto tool: tools)
         delete tool;
 
+    info.Write(out);
     out->Write();
     out->Close();
     delete out;
+    delete reader;
+    return 0;
+}
+
+
+int merge_files(std::string out_file, std::vector<std::string> in_files, bool skip_run_info)
+{
+    TFileMerger merger(false);
+    if (!merger.OutputFile(out_file.c_str(), "CREATE"))
+        return 1;
+
+    for (auto& in_file: in_files)
+        if (!merger.AddFile(in_file.c_str(), false))
+            return 1;
+
+    int type = TFileMerger::kAll | TFileMerger::kRegular;
+    if (skip_run_info) {
+        merger.AddObjectNames("RunInfo");
+        type |= TFileMerger::kSkipListed;
+    }
+    return merger.PartialMerge(type) ? 0 : 1;
+}
+
+
+// Combines shard outputs of one chain. The shards have to come from the same
+// inputs and configuration and together cover every entry exactly once. They
+// are merged in groups in parallel first, then the groups in entry order.
+int merge(std::string out_file, std::vector<std::string> in_files, int threads)
+{
+    std::cout << "Running mode merge." << std::endl;
+
+    std::vector<std::pair<RunInfo, std::string>> shards;
+
+    for (auto& in_file: in_files) {
+        TFile* file = TFile::Open(in_file.c_str(), "READ");
+        if (file == nullptr || file->IsZombie()) {
+            std::cout << "Error opening shard " << in_file << "." << std::endl;
+            return 1;
+        }
+
+        RunInfo info;
+        bool valid = info.Read(file);
+        file->Close();
+        delete file;
+
+        if (!valid) {
+            std::cout << "Shard " << in_file << " has no RunInfo, is it an analysis output?" << std::endl;
+            return 1;
+        }
+        if (!shards.empty() && !shards.front().first.SameRun(info)) {
+            std::cout << "Shard " << in_file << " was made from different inputs or configuration than "
+                << shards.front().second << "." << std::endl;
+            return 1;
+        }
+        shards.emplace_back(info, in_file);
+    }
+
+    if (shards.empty()) {
+        std::cout << "No shards to merge." << std::endl;
+        return 1;
+    }
+
+    std::sort(shards.begin(), shards.end(), [](const std::pair<RunInfo, std::string>& a, const std::pair<RunInfo, std::string>& b) {
+        return a.first.first_entry < b.first.first_entry;
+    });
+
+    // Every shard applies the ntupler jet cap on its own. Once a shard stopped
+    // on it, the later shards lie past the stop of a single run.
+    const std::pair<RunInfo, std::string>* stopped = nullptr;
+    long long next_entry = 0;
+    for (auto& shard: shards) {
+        if (stopped != nullptr) {
+            std::cout << "Shard " << stopped->second << " stopped at entry " << stopped->first.stopped_entry
+                << " as every tool was saturated, but is followed by " << shard.second << "." << std::endl;
+            return 1;
+        }
+        if (shard.first.first_entry < next_entry) {
+            std::cout << "Shard " << shard.second << " overlaps with the previous shard at entry "
+                << shard.first.first_entry << "." << std::endl;
+            return 1;
+        }
+        if (shard.first.first_entry > next_entry) {
+            std::cout << "Entries " << next_entry << " to " << shard.first.first_entry << " are missing." << std::endl;
+            return 1;
+        }
+        next_entry = shard.first.last_entry;
+        if (shard.first.stopped_entry < shard.first.last_entry)
+            stopped = &shard;
+    }
+    // The entries after a stopped last shard are not needed
+    if (next_entry != shards.front().first.chain_entries && stopped == nullptr) {
+        std::cout << "Entries " << next_entry << " to " << shards.front().first.chain_entries << " are missing." << std::endl;
+        return 1;
+    }
+
+    std::vector<std::string> sorted_files;
+    for (auto& shard: shards)
+        sorted_files.push_back(shard.second);
+
+    int groups = std::max(1, std::min<int>(threads, sorted_files.size() / 2));
+    std::vector<std::string> group_files;
+    int status = 0;
+
+    if (groups == 1) {
+        status = merge_files(out_file, sorted_files, true);
+    } else {
+        ROOT::EnableThreadSafety();
+
+        std::vector<int> group_status(groups, 0);
+        for (int g = 0; g < groups; ++g)
+            group_files.push_back(out_file + ".group" + std::to_string(g) + ".root");
+
+        tbb::task_arena arena(groups);
+        arena.execute([&] {
+            tbb::parallel_for(0, groups, [&](int g) {
+                size_t first = sorted_files.size() * g / groups;
+                size_t last = sorted_files.size() * (g + 1) / groups;
+                std::vector<std::string> group(sorted_files.begin() + first, sorted_files.begin() + last);
+                gSystem->Unlink(group_files[g].c_str());
+                group_status[g] = merge_files(group_files[g], group, true);
+            }, tbb::simple_partitioner());
+        });
+
+        for (int g = 0; g < groups; ++g)
+            status |= group_status[g];
+        if (status == 0)
+            status = merge_files(out_file, group_files, false);
+
+        for (auto& group_file: group_files)
+            gSystem->Unlink(group_file.c_str());
+    }
+
+    if (status != 0) {
+        std::cout << "Error merging shards into " << out_file << ", does it already exist?" << std::endl;
+        return 1;
+    }
+
+    RunInfo info = shards.front().first;
+    info.first_entry = 0;
+    info.last_entry = info.chain_entries;
+    info.stopped_entry = shards.back().first.stopped_entry;
+
+    TFile* out = TFile::Open(out_file.c_str(), "UPDATE");
+    info.Write(out);
+    out->Close();
+    delete out;
+
+    std::cout << "Merged " << shards.size() << " shards covering " << info.stopped_entry << " of " << info.chain_entries
+        << " entries." << std::endl;
     return 0;
 }
 
+// Parses a non-negative entry number, the whole text must be consumed
+bool parse_entry(const std::string& text, long long& entry)
+{
+    if (text.empty() || !std::isdigit((unsigned char) text[0]))
+        return false;
+
+    char* end;
+    errno = 0;
+    entry = std::strtoll(text.c_str(), &end, 10);
+    return errno == 0 && *end == '\0';
+}
+
+
 int main(int argc, char* argv[]) {
     if (argc < 3) {
         std::cout << "Mode analysis, operations: event_consistency, reco, ntupler" << std::endl;
         std::cout << "Usage: " << argv[0] << " analysis <in_file> <out_file> <operation1> [operation2]" << std::endl;
         std::cout << "Usage: " << argv[0] << " analysis <in_file> <out_file> ntupler <SignalWplus,SignalWminus,BackgroundQQ,BackgroundGG>" << std::endl;
+        std::cout << "Options: --threads <N>          split the chain over N worker threads" << std::endl;
+        std::cout << "         --procs <N>            split the chain over N forked worker processes" << std::endl;
+        std::cout << "         --shard <i/N>          process only shard i (0-based) of N equal entry ranges" << std::endl;
+        std::cout << "         --entries <first:last> process only the entries [first, last)" << std::endl;
+        std::cout << "         --staged-read          read constituents and EFlow only for selected events" << std::endl;
+        std::cout << "         --read-cache <MB>      TTreeCache size for the branches read every entry, 0 for none (default 64)" << std::endl;
+        std::cout << "         --prefetch             unzip cached baskets in background tasks and open the next file ahead" << std::endl;
+        std::cout << "         --profile <file.json>  time the I/O and tool stages and write a JSON report" << std::endl;
+        std::cout << "         --kernels <mode>       ntupler kernels: auto (default), scalar, avx2 or validate" << std::endl;
+        std::cout << "         --features <list>      ntupler features to compute and write, 'scalars' for all but jet_image" << std::endl;
+        std::cout << "         --image-format <fmt>   ntupler jet images: dense (default), float, half or sparse" << std::endl;
+        std::cout << "         --image-dim <N>        ntupler jet images of N x N pixels (default 20)" << std::endl;
+        std::cout << "         --image-r <R>          ntupler jet images cover +-R in eta and phi (default 0.2)" << std::endl;
+        std::cout << "         --image-channels <c>   ntupler jet image channels out of track,eem,ehad (default all)" << std::endl;
+        std::cout << "         --image-view <spec>    extra ntupler jet image name:axis|subjet:dim:r[:rotate][:flip], repeatable" << std::endl;
+        std::cout << "         --point-cloud          ntupler also writes the jet constituents as cloud_* arrays" << std::endl;
+        std::cout << "         --output-profile <p>   output storage: default, compact, fast-write or archival" << std::endl;
+        std::cout << "         --max-jets <N>         ntupler stops after N jets, 0 for no limit (default 80000)" << std::endl;
+        std::cout << "         --unique-matching      ntupler matches every background jet to at most one GenJet" << std::endl;
+        std::cout << "         --npy-dir <dir>        ntupler also writes every DS branch as <dir>/<branch>.npy" << std::endl;
+        std::cout << "         --output-queue <N>     ntupler fills its outputs on a writer thread, buffering up to N jets" << std::endl;
+        std::cout << "         --tagger <file>        ntupler scores every jet with a model from 'ml_tool export'" << std::endl;
+        std::cout << "         --tagger-cut <x>       ntupler writes only jets with a tagger score of at least x" << std::endl;
+        std::cout << "Mode: merge" << std::endl;
+        std::cout << "Usage: " << argv[0] << " merge <out_file> <shard1> [shard2...] [--threads <N>]" << std::endl;
         std::cout << "Mode: plot" << std::endl;
         std::cout << "Usage #1: " << argv[0] << " plot <in_file1> <in_file2>" << std::endl;
         std::cout << "Usage #2: " << argv[0] << " plot <in_file1>" << std::endl;
@@ -124,14 +770,169 @@ int main(int argc, char* argv[]) {
             std::cout << "Need at least an in_file, out_file and a tool" << std::endl;
             return 1;
         }
-        std::string in_file(argv[2]);
-        std::string out_file(argv[3]);
-        std::vector<std::string> tools;
+        std::vector<std::string> args;
+        AnalysisOptions options;
+        bool sharded = false;
+        bool entry_range = false;
 
-        for(int i = 4; i < argc; ++i)
-            tools.emplace_back(argv[i]);
+        for (int i = 2; i < argc; ++i) {
+            std::string arg(argv[i]);
+            if (arg == "--threads" && i + 1 < argc) {
+                options.threads = std::max(1, std::atoi(argv[++i]));
+            } else if (arg == "--procs" && i + 1 < argc) {
+                options.procs = std::max(1, std::atoi(argv[++i]));
+            } else if (arg == "--profile" && i + 1 < argc) {
+                options.profile_file = argv[++i];
+            } else if (arg == "--kernels" && i + 1 < argc) {
+                if (!SubstructureKernels::ParseMode(argv[++i], options.kernels)) {
+                    std::cout << "Unknown kernel mode '" << argv[i] << "'." << std::endl;
+                    return 1;
+                }
+            } else if (arg == "--features" && i + 1 < argc) {
+                if (!FeatureSelection::Parse(argv[++i], options.ntupler.features)) {
+                    std::cout << "Invalid feature list '" << argv[i] << "'." << std::endl;
+                    return 1;
+                }
+            } else if (arg == "--image-format" && i + 1 < argc) {
+                if (!JetImageWriter::ParseFormat(argv[++i], options.ntupler.image_format)) {
+                    std::cout << "Unknown image format '" << argv[i] << "'." << std::endl;
+                    return 1;
+                }
+            } else if (arg == "--image-dim" && i + 1 < argc) {
+                int dim = std::atoi(argv[++i]);
+                // the sparse format indexes pixels with 16 bits
+                if (dim < 1 || dim > 128) {
+                    std::cout << "Invalid image dimension '" << argv[i] << "', expected 1 to 128." << std::endl;
+                    return 1;
+                }
+                options.ntupler.image.dim = dim;
+            } else if (arg == "--image-r" && i + 1 < argc) {
+                options.ntupler.image.r_size = std::atof(argv[++i]);
+                if (!(options.ntupler.image.r_size > 0.)) {
+                    std::cout << "Invalid image size '" << argv[i] << "'." << std::endl;
+                    return 1;
+                }
+            } else if (arg == "--image-channels" && i + 1 < argc) {
+                if (!JetImageGeometry::ParseChannels(argv[++i], options.ntupler.image.channels)) {
+                    std::cout << "Invalid image channels '" << argv[i] << "', expected a list of track,eem,ehad." << std::endl;
+                    return 1;
+                }
+            } else if (arg == "--image-view" && i + 1 < argc) {
+                JetImageView view;
+                auto& views = options.ntupler.image_views;
+                if (!JetImageView::Parse(argv[++i], view)) {
+                    std::cout << "Invalid image view '" << argv[i] << "', expected name:axis|subjet:dim:r[:rotate][:flip]." << std::endl;
+                    return 1;
+                }
+                if (std::any_of(views.begin(), views.end(), [&](const JetImageView& other) { return other.name == view.name; })) {
+                    std::cout << "Duplicate image view name '" << view.name << "'." << std::endl;
+                    return 1;
+                }
+                views.push_back(view);
+            } else if (arg == "--output-profile" && i + 1 < argc) {
+                if (!OutputProfile::Parse(argv[++i], options.ntupler.output)) {
+                    std::cout << "Unknown output profile '" << argv[i] << "'." << std::endl;
+                    return 1;
+                }
+            } else if (arg == "--max-jets" && i + 1 < argc) {
+                long long max_jets = std::atoll(argv[++i]);
+                if (max_jets < 0) {
+                    std::cout << "Invalid jet limit '" << argv[i] << "'." << std::endl;
+                    return 1;
+                }
+                options.ntupler.max_jets = max_jets == 0 ? std::numeric_limits<long long>::max() : max_jets;
+            } else if (arg == "--unique-matching") {
+                options.ntupler.unique_matching = true;
+            } else if (arg == "--npy-dir" && i + 1 < argc) {
+                options.ntupler.npy_directory = argv[++i];
+            } else if (arg == "--output-queue" && i + 1 < argc) {
+                options.ntupler.output_queue = std::max(0, std::atoi(argv[++i]));
+            } else if (arg == "--tagger" && i + 1 < argc) {
+                options.ntupler.tagger_file = argv[++i];
+            } else if (arg == "--tagger-cut" && i + 1 < argc) {
+                char* end;
+                options.ntupler.tagger_cut = std::strtod(argv[++i], &end);
+                if (end == argv[i] || *end != '\0' || !std::isfinite(options.ntupler.tagger_cut)) {
+                    std::cout << "Invalid tagger cut '" << argv[i] << "', expected a number." << std::endl;
+                    return 1;
+                }
+            } else if (arg == "--point-cloud") {
+                options.ntupler.point_cloud = true;
+            } else if (arg == "--staged-read") {
+                options.staged_read = true;
+            } else if (arg == "--read-cache" && i + 1 < argc) {
+                options.read.cache_mb = std::max(0, std::atoi(argv[++i]));
+            } else if (arg == "--prefetch") {
+                options.read.prefetch = true;
+            } else if (arg == "--shard" && i + 1 < argc) {
+                sharded = true;
+                if (std::sscanf(argv[++i], "%d/%d", &options.shard, &options.shards) != 2 ||
+                    options.shards < 1 || options.shard < 0 || options.shard >= options.shards) {
+                    std::cout << "Invalid shard '" << argv[i] << "', expected i/N with 0 <= i < N." << std::endl;
+                    return 1;
+                }
+            } else if (arg == "--entries" && i + 1 < argc) {
+                std::string range(argv[++i]);
+                size_t colon = range.find(':');
+                if (colon == std::string::npos) {
+                    std::cout << "Invalid entry range '" << range << "', expected first:last." << std::endl;
+                    return 1;
+                }
+                if (!parse_entry(range.substr(0, colon), options.first_entry) ||
+                    (colon + 1 < range.size() && !parse_entry(range.substr(colon + 1), options.last_entry)) ||
+                    (options.last_entry >= 0 && options.first_entry > options.last_entry)) {
+                    std::cout << "Invalid entry range '" << range << "', expected first:last with 0 <= first <= last." << std::endl;
+                    return 1;
+                }
+                entry_range = true;
+            } else {
+                args.push_back(arg);
+            }
+        }
 
-        return analysis(in_file, out_file, tools);
+        if (args.size() < 3) {
+            std::cout << "Need at least an in_file, out_file and a tool" << std::endl;
+            return 1;
+        }
+        if (options.ntupler.tagger_file.empty() && std::isfinite(options.ntupler.tagger_cut)) {
+            std::cout << "--tagger-cut needs a --tagger." << std::endl;
+            return 1;
+        }
+        if (!options.ntupler.tagger_file.empty() && !options.ntupler.CheckTagger())
+            return 1;
+        if (sharded && entry_range) {
+            std::cout << "--shard cannot be combined with --entries." << std::endl;
+            return 1;
+        }
+        // The timers of forked workers are discarded at their _exit, so a
+        // profile would only cover the main process waiting and merging.
+        if (options.procs > 1 && (options.threads > 1 || !options.profile_file.empty())) {
+            std::cout << "--procs cannot be combined with --threads or --profile." << std::endl;
+            return 1;
+        }
+        std::string in_file(args[0]);
+        std::string out_file(args[1]);
+        std::vector<std::string> tools(args.begin() + 2, args.end());
+
+        return analysis(in_file, out_file, tools, options);
+    } else if (mode == "merge") {
+        std::vector<std::string> args;
+        int threads = 1;
+
+        for (int i = 2; i < argc; ++i) {
+            std::string arg(argv[i]);
+            if (arg == "--threads" && i + 1 < argc) {
+                threads = std::max(1, std::atoi(argv[++i]));
+            } else {
+                args.push_back(arg);
+            }
+        }
+
+        if (args.size() < 2) {
+            std::cout << "Need an out_file and at least one shard" << std::endl;
+            return 1;
+        }
+        return merge(args[0], std::vector<std::string>(args.begin() + 1, args.end()), threads);
     } else {
         std::cout << "Unknown mode " << mode << "." << std::endl;
         return 1;
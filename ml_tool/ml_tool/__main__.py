@@ -63,6 +63,11 @@ def parse_arguments(args) -> argparse.Namespace:
     group4.add_argument("--test-qq", action='store_true', help="Test on qq only")
     group4.add_argument("--test-gg", action='store_true', help="Test on gg only")
 
+    ##export
+    export_parser = subparsers.add_parser("export", help="Export a model as a weights file for the AnalysisTool tagger")
+    export_parser.add_argument("-m", "--model", type=str, help="Model")
+    export_parser.add_argument("-o", "--output", type=str, default="tagger.weights", help="Weights file to write")
+
     return parser, parser.parse_args(args)
 
 
@@ -211,6 +216,11 @@ def command(args):
         dataset = DataSet(arguments.data_directory, train_mode, test_mode)
         reevaluate(Path(arguments.model), dataset)
 
+    ##export a model for the AnalysisTool
+    if arguments.subtool == 'export':
+        from .export import export
+        export(arguments.model, arguments.output)
+
 
 def main():
     return command(sys.argv[1:])
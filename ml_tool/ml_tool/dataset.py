@@ -6,6 +6,8 @@ from sklearn.utils import shuffle
 import numpy as np
 import uproot
 
+from .jet_image import load_jet_images
+from .npy_columns import NpyColumns
 
 
 class BackgroundMode(Enum):
@@ -25,8 +27,17 @@ class DataSet:
     @staticmethod
     def transform(keys, data):
         keys = keys.copy()
+        if isinstance(data, NpyColumns):
+            if 'jet_image' not in keys:
+                return data.features(keys, entry_stop=80000)
+            jet_img_data = data.jet_images(entry_stop=80000)
+            keys.remove('jet_image')
+            if not keys:
+                return jet_img_data
+            return data.features(keys, entry_stop=80000), jet_img_data
+
         if 'jet_image' in keys:
-            jet_img_data = data['jet_image'].array(library='np')[:80000]
+            jet_img_data = load_jet_images(data, entry_stop=80000)
             keys.remove('jet_image')
             if not keys:
                 return jet_img_data
@@ -37,14 +48,21 @@ class DataSet:
 
     def __init__(self, directory, train_mode=BackgroundMode.Mixed, test_mode=BackgroundMode.Mixed, keys=nominal_keys):
         path = Path(directory).resolve()
-        self.gg_up = uproot.open(str(path / 'gg_ntuples.root') + ":DS")
-        self.qq_up = uproot.open(str(path / 'qq_ntuples.root') + ":DS")
-        self.wp_up = uproot.open(str(path / 'wp_ntuples.root') + ":DS")
-        self.wm_up = uproot.open(str(path / 'wm_ntuples.root') + ":DS")
+        self.gg_up = self.open_ntuples(path, 'gg')
+        self.qq_up = self.open_ntuples(path, 'qq')
+        self.wp_up = self.open_ntuples(path, 'wp')
+        self.wm_up = self.open_ntuples(path, 'wm')
         self.train_mode = train_mode
         self.test_mode = test_mode
         self.reset_keys(keys)
 
+    @staticmethod
+    def open_ntuples(path, sample):
+        # The memory mapped --npy-dir output if there is one, the ROOT file otherwise
+        if NpyColumns.exists(path / f'{sample}_ntuples'):
+            return NpyColumns(path / f'{sample}_ntuples')
+        return uproot.open(str(path / f'{sample}_ntuples.root') + ":DS")
+
     def _preload_data(self):
         self.gg_data = self.transform(self._keys, self.gg_up)
         self.qq_data = self.transform(self._keys, self.qq_up)
@@ -0,0 +1,89 @@
+from pathlib import Path
+
+import numpy as np
+from tensorflow import keras
+
+from .model import Model
+
+
+def _parents(layer):
+    node = layer._inbound_nodes[0]
+    if hasattr(node, 'inbound_layers'):
+        parents = node.inbound_layers
+        return parents if isinstance(parents, list) else [parents]
+    return [parent.operation for parent in node.parent_nodes]
+
+
+def _chain(layer):
+    """Layers from the model input up to and including layer, stopping at an
+    InputLayer or a Concatenate (returned separately)."""
+    chain = []
+    while not isinstance(layer, (keras.layers.InputLayer, keras.layers.Concatenate)):
+        chain.append(layer)
+        parents = _parents(layer)
+        if not parents:
+            break
+        layer = parents[0]
+    return list(reversed(chain)), layer if isinstance(layer, keras.layers.Concatenate) else None
+
+
+def _values(out, array):
+    out.write(' '.join(f'{value:.9g}' for value in np.asarray(array, dtype=np.float32).ravel()) + '\n')
+
+
+def _write_branch(out, shape, chain):
+    layers = [layer for layer in chain if not isinstance(layer, keras.layers.Dropout)]
+    out.write(f'{shape[0]} {shape[1]} {shape[2]} {len(layers)}\n')
+
+    for layer in layers:
+        config = layer.get_config()
+        if isinstance(layer, keras.layers.Dense):
+            kernel, bias = layer.get_weights()
+            out.write(f'dense {kernel.shape[0]} {kernel.shape[1]} {config["activation"]}\n')
+            _values(out, kernel)
+            _values(out, bias)
+        elif isinstance(layer, keras.layers.Conv2D):
+            if config['padding'] != 'same' or tuple(config['strides']) != (1, 1):
+                raise ValueError(f'Only stride 1 convolutions with same padding can be exported, not {layer.name}')
+            kernel, bias = layer.get_weights()
+            out.write(f'conv2d {kernel.shape[0]} {kernel.shape[1]} {kernel.shape[2]} {kernel.shape[3]} {config["activation"]}\n')
+            _values(out, kernel)
+            _values(out, bias)
+        elif isinstance(layer, keras.layers.MaxPooling2D):
+            pool = tuple(config['pool_size'])
+            if config['padding'] != 'valid' or tuple(config['strides'] or pool) != pool:
+                raise ValueError(f'Only non-overlapping valid max pooling can be exported, not {layer.name}')
+            out.write(f'maxpool2d {pool[0]} {pool[1]}\n')
+        elif isinstance(layer, keras.layers.Flatten):
+            out.write('flatten\n')
+        else:
+            raise ValueError(f'Layer {layer.name} of type {type(layer).__name__} cannot be exported')
+
+
+def export(model_path, output_file):
+    """Writes a trained model as the plain text weights file read by the
+    AnalysisTool tagger (analyze ... --tagger <file>)."""
+    model = Model.load(Path(model_path))
+    keys = [key for key in model.metadata['keys'] if key != 'jet_image']
+
+    head, concatenate = _chain(model.model.layers[-1])
+    branches = [_chain(parent)[0] for parent in _parents(concatenate)] if concatenate else [head]
+    if not concatenate:
+        head = []
+
+    with open(output_file, 'w') as out:
+        out.write('ds_tagger 1\n')
+        combined = 0
+        for chain in branches:
+            input_shape = tuple(chain[0].input.shape[1:])
+            if len(input_shape) == 1:
+                out.write(f'features {len(keys)} {" ".join(keys)}\n')
+                _write_branch(out, (1, 1, input_shape[0]), chain)
+            else:
+                out.write('image\n')
+                _write_branch(out, input_shape, chain)
+            combined += int(np.prod(chain[-1].output.shape[1:]))
+        out.write('head\n')
+        _write_branch(out, (1, 1, combined), head)
+        out.write('end\n')
+    print(f'Exported {model.name} to {output_file}.')
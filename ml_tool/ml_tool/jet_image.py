@@ -0,0 +1,58 @@
+import numpy as np
+
+
+def image_shape(tree, view=None, default=(20, 20, 3)):
+    """(eta, phi, channel) shape of the jet images of the main view (or the
+    named extra view), from the image geometry recorded in the RunInfo
+    configuration of the file."""
+    try:
+        configuration = tree.file.root_directory['RunInfo/configuration'].member('fTitle')
+    except Exception:
+        return default
+
+    items = [item.split('=', 1) for item in configuration.split() if '=' in item]
+    settings = dict(items)
+    if 'image_dim' not in settings or 'image_channels' not in settings:
+        return default
+    channels = len(settings['image_channels'].split(','))
+
+    if view is None:
+        dim = int(settings['image_dim'])
+        return (dim, dim, channels)
+
+    # image_view=name:centre:dim:r[:rotate][:flip]
+    for key, value in items:
+        fields = value.split(':')
+        if key == 'image_view' and fields[0] == view:
+            dim = int(fields[2])
+            return (dim, dim, channels)
+    raise KeyError(f'No image view {view} in the RunInfo configuration')
+
+
+def load_jet_images(tree, entry_stop=None, shape=None, view=None):
+    """Read the jet images of an ntupler DS tree as a dense array of
+    (eta, phi, channel) shape, whatever --image-format they were written with.
+    view selects an extra --image-view instead of the main jet_image."""
+    keys = tree.keys()
+    prefix = 'jet_image' if view is None else f'jet_image_{view}'
+    if shape is None:
+        shape = image_shape(tree, view)
+
+    if f'{prefix}_index' in keys:
+        # Sparse: flat row-major pixel index and float32 value of the non-zero pixels
+        arrays = tree.arrays([f'{prefix}_n', f'{prefix}_index', f'{prefix}_value'], entry_stop=entry_stop, library='np')
+        counts = arrays[f'{prefix}_n']
+        images = np.zeros((len(counts), int(np.prod(shape))), dtype=np.float32)
+        if counts.sum() > 0:
+            rows = np.repeat(np.arange(len(counts)), counts)
+            images[rows, np.concatenate(arrays[f'{prefix}_index']).astype(np.int64)] = \
+                np.concatenate(arrays[f'{prefix}_value'])
+        return images.reshape((len(counts),) + tuple(shape))
+
+    if f'{prefix}_f16' in keys:
+        # Half: IEEE binary16 bits stored as uint16
+        bits = tree[f'{prefix}_f16'].array(entry_stop=entry_stop, library='np')
+        return bits.astype(np.uint16).view(np.float16).astype(np.float32)
+
+    # Dense float64 or float32
+    return tree[prefix].array(entry_stop=entry_stop, library='np')
@@ -0,0 +1,75 @@
+import json
+from pathlib import Path
+
+import numpy as np
+
+
+class NpyColumns:
+    """The --npy-dir output of the ntupler: one .npy file per DS branch plus a
+    manifest.json. Columns are memory mapped, nothing is read until used."""
+
+    def __init__(self, directory):
+        self.directory = Path(directory)
+        with open(self.directory / 'manifest.json') as manifest:
+            self.manifest = json.load(manifest)
+        self._columns = {}
+
+    @staticmethod
+    def exists(directory):
+        return (Path(directory) / 'manifest.json').is_file()
+
+    def keys(self):
+        return list(self.manifest['columns'])
+
+    def __len__(self):
+        return self.manifest['rows']
+
+    def __getitem__(self, key):
+        if key not in self._columns:
+            self._columns[key] = np.load(self.directory / f'{key}.npy', mmap_mode='r')
+        return self._columns[key]
+
+    def offsets(self, key):
+        """Row offsets into the flat ragged column key."""
+        counts = self[self.manifest['columns'][key]['counts']]
+        offsets = np.zeros(len(counts) + 1, dtype=np.int64)
+        np.cumsum(counts, out=offsets[1:])
+        return offsets
+
+    def features(self, keys, entry_stop=None):
+        """(rows, len(keys)) array of scalar columns, as the ROOT path builds it."""
+        return np.stack([self[key][:entry_stop] for key in keys], axis=1)
+
+    def jet_images(self, entry_stop=None, view=None):
+        """Dense (rows, dim, dim, channels) jet images, whatever --image-format
+        they were written with."""
+        prefix = 'jet_image' if view is None else f'jet_image_{view}'
+        columns = self.manifest['columns']
+
+        if f'{prefix}_index' in columns:
+            rows = len(self) if entry_stop is None else min(entry_stop, len(self))
+            offsets = self.offsets(f'{prefix}_index')
+            stop = offsets[rows]
+            shape = self._sparse_shape(prefix)
+            images = np.zeros((rows, int(np.prod(shape))), dtype=np.float32)
+            images[np.repeat(np.arange(rows), np.diff(offsets[:rows + 1])), self[f'{prefix}_index'][:stop]] = \
+                self[f'{prefix}_value'][:stop]
+            return images.reshape((rows,) + shape)
+
+        if f'{prefix}_f16' in columns:
+            return self[f'{prefix}_f16'][:entry_stop].astype(np.float32)
+
+        return self[prefix][:entry_stop]
+
+    def _sparse_shape(self, prefix):
+        # Sparse images do not record their shape, it comes from the image geometry
+        settings = dict(item.split('=', 1) for item in self.manifest.get('configuration', '').split() if '=' in item)
+        channels = len(settings.get('image_channels', 'track,eem,ehad').split(','))
+        if prefix == 'jet_image':
+            dim = int(settings.get('image_dim', 20))
+        else:
+            name = prefix[len('jet_image_'):]
+            views = [item.split('=', 1)[1].split(':') for item in self.manifest.get('configuration', '').split()
+                     if item.startswith('image_view=')]
+            dim = next(int(view[2]) for view in views if view[0] == name)
+        return (dim, dim, channels)
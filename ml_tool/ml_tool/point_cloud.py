@@ -0,0 +1,32 @@
+import awkward as ak
+import numpy as np
+
+from .npy_columns import NpyColumns
+
+
+cloud_keys = [
+    'cloud_type', 'cloud_delta_eta', 'cloud_delta_phi', 'cloud_pt_fraction', 'cloud_e_fraction',
+    'cloud_charge', 'cloud_eem', 'cloud_ehad'
+]
+
+
+def load_point_cloud(tree, entry_stop=None, keys=cloud_keys):
+    """Read the --point-cloud constituents of an ntupler DS tree as flat
+    per-constituent columns plus offsets: the constituents of jet i are
+    columns[key][offsets[i]:offsets[i + 1]]. Tracks come before towers
+    (cloud_type 0 and 1) within each jet. tree may also be the NpyColumns of
+    an --npy-dir output, whose columns are already flat."""
+    if isinstance(tree, NpyColumns):
+        offsets = tree.offsets(keys[0])
+        rows = len(offsets) - 1 if entry_stop is None else min(entry_stop, len(offsets) - 1)
+        return {key: tree[key][:offsets[rows]] for key in keys}, offsets[:rows + 1]
+
+    counts = tree['cloud_n'].array(entry_stop=entry_stop, library='np')
+    offsets = np.zeros(len(counts) + 1, dtype=np.int64)
+    np.cumsum(counts, out=offsets[1:])
+
+    columns = {
+        key: ak.to_numpy(ak.flatten(tree[key].array(entry_stop=entry_stop, library='ak')))
+        for key in keys
+    }
+    return columns, offsets